@@ -0,0 +1,155 @@
+#include "timer.h"
+#include "uart.h"
+#include "printf.h"
+#include "console.h"
+#include "gl.h"
+#include "glextra.h"
+
+/*
+ * Measures how fast the console and gl draw, using the system timer,
+ * and prints a table of results over the uart. Each benchmark runs a
+ * fixed number of operations and reports the average time per operation
+ * and operations per second.
+ *
+ * Links against libmypi for our console and gl, build and run it on
+ * the Pi with `make console-bench`. Also builds natively against the
+ * framebuffer stubs in host/ with `make host`, to compare changes
+ * without a Pi.
+ */
+
+#define NROWS 20
+#define NCOLS 40
+
+#define STREAM_LINES 200
+// longer than a row, so every line wraps once
+#define STREAM_LINE_LEN (NCOLS + NCOLS / 2)
+#define SCROLL_LINES 100
+#define CLEAR_COUNT 20
+#define SWAP_COUNT 20
+#define RECT_COUNT 1000
+#define RECT_SIZE 32
+#define GLYPH_COUNT 5000
+
+static unsigned int start_ticks;
+
+static void start_timer(void)
+{
+    start_ticks = timer_get_ticks();
+}
+
+static unsigned int elapsed_us(void)
+{
+    unsigned int elapsed = timer_get_ticks() - start_ticks;
+    // avoid dividing by zero on very fast runs
+    return elapsed ? elapsed : 1;
+}
+
+// helper function to print a string padded with spaces to width
+static void print_padded(const char *str, int width)
+{
+    int len = printf("%s", str);
+    while (len++ < width) printf(" ");
+}
+
+// helper function to print one row of the results table
+static void report(const char *name, const char *unit, unsigned int count, unsigned int elapsed)
+{
+    unsigned long long ns_per_op = (unsigned long long) elapsed * 1000 / count;
+    unsigned long long per_sec = (unsigned long long) count * 1000000 / elapsed;
+    char buf[16];
+
+    print_padded(name, 20);
+    snprintf(buf, sizeof(buf), "%d", count);
+    print_padded(buf, 10);
+    snprintf(buf, sizeof(buf), "%d", elapsed);
+    print_padded(buf, 12);
+    snprintf(buf, sizeof(buf), "%d", (unsigned int) ns_per_op);
+    print_padded(buf, 12);
+    printf("%d %s/s\n", (unsigned int) per_sec, unit);
+}
+
+static void bench_console(void)
+{
+    char line[STREAM_LINE_LEN + 1];
+    for (int i = 0; i < STREAM_LINE_LEN; i++) {
+        line[i] = 'a' + (i % 26);
+    }
+    line[STREAM_LINE_LEN] = '\0';
+
+    console_init(NROWS, NCOLS);
+    console_clear();
+
+    // long lines that wrap and scroll, like streaming log output
+    start_timer();
+    for (int i = 0; i < STREAM_LINES; i++) {
+        console_printf("%s\n", line);
+    }
+    report("console stream", "chars", STREAM_LINES * (STREAM_LINE_LEN + 1), elapsed_us());
+
+    // screen is full, so each newline costs one scroll
+    start_timer();
+    for (int i = 0; i < SCROLL_LINES; i++) {
+        console_printf("x\n");
+    }
+    report("console scroll", "lines", SCROLL_LINES, elapsed_us());
+
+    start_timer();
+    for (int i = 0; i < SCROLL_LINES; i++) {
+        gl_scroll_up(gl_get_char_height(), GL_BLACK);
+    }
+    report("gl_scroll_up", "lines", SCROLL_LINES, elapsed_us());
+}
+
+static void bench_gl(void)
+{
+    gl_init(NCOLS * gl_get_char_width(), NROWS * gl_get_char_height(), GL_DOUBLEBUFFER);
+    int width = gl_get_width();
+    int height = gl_get_height();
+
+    start_timer();
+    for (int i = 0; i < CLEAR_COUNT; i++) {
+        gl_clear(GL_BLUE);
+    }
+    report("gl_clear", "clears", CLEAR_COUNT, elapsed_us());
+
+    start_timer();
+    for (int i = 0; i < SWAP_COUNT; i++) {
+        gl_swap_buffer();
+    }
+    report("gl_swap_buffer", "swaps", SWAP_COUNT, elapsed_us());
+
+    start_timer();
+    for (int i = 0; i < RECT_COUNT; i++) {
+        gl_draw_rect((i * 7) % (width - RECT_SIZE), (i * 13) % (height - RECT_SIZE),
+                     RECT_SIZE, RECT_SIZE, GL_RED);
+    }
+    report("gl_draw_rect 32x32", "rects", RECT_COUNT, elapsed_us());
+
+    int cols = width / gl_get_char_width();
+    int rows = height / gl_get_char_height();
+    start_timer();
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        gl_draw_char((i % cols) * gl_get_char_width(), ((i / cols) % rows) * gl_get_char_height(),
+                     'A' + (i % 26), GL_WHITE);
+    }
+    report("gl_draw_char", "glyphs", GLYPH_COUNT, elapsed_us());
+}
+
+void main(void)
+{
+    timer_init();
+    uart_init();
+
+    printf("\nconsole/gl benchmark, %dx%d console\n", NCOLS, NROWS);
+    print_padded("benchmark", 20);
+    print_padded("count", 10);
+    print_padded("total us", 12);
+    print_padded("ns/op", 12);
+    printf("rate\n");
+
+    bench_console();
+    bench_gl();
+
+    printf("done.\n");
+    uart_flush();
+}
@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "gl.h"
+#include "malloc.h"
+#include "printf.h"
+#include "strings.h"
+#include "timer.h"
+
+// placed around the .bench section by memmap
+extern const bench_t __bench_start__[];
+extern const bench_t __bench_end__[];
+
+// a sample must take this long for the timer's resolution not to matter
+#define MIN_SAMPLE_US 1000
+#define MAX_REPS (1 << 20)
+#define WARMUP_RUNS 2
+
+int bench_count(void)
+{
+    return __bench_end__ - __bench_start__;
+}
+
+const bench_t *bench_get(int i)
+{
+    if (i < 0 || i >= bench_count()) return 0;
+    return &__bench_start__[i];
+}
+
+const bench_t *bench_find(const char *name)
+{
+    for (int i = 0; i < bench_count(); i++) {
+        if (strcmp(name, __bench_start__[i].name) == 0) return &__bench_start__[i];
+    }
+    return 0;
+}
+
+// helper function to time `reps` operations, returns microseconds
+// and the bytes moved by the last one in `bytes`
+static unsigned int time_reps(const bench_t *bench, unsigned int reps, unsigned int *bytes)
+{
+    unsigned int start = timer_get_ticks();
+    for (unsigned int i = 0; i < reps; i++) {
+        *bytes = bench->fn();
+    }
+    return timer_get_ticks() - start;
+}
+
+bool bench_run(const bench_t *bench, int nsamples, bench_result_t *result)
+{
+    if ((bench->flags & BENCH_NEEDS_GL) && gl_get_width() == 0) return false;
+    if (nsamples < 1) nsamples = 1;
+    if (nsamples > BENCH_MAX_SAMPLES) nsamples = BENCH_MAX_SAMPLES;
+
+    // warm caches, then double the batch until it is long enough to time
+    unsigned int bytes = 0;
+    for (int i = 0; i < WARMUP_RUNS; i++) {
+        bytes = bench->fn();
+    }
+    unsigned int reps = 1;
+    while (reps < MAX_REPS && time_reps(bench, reps, &bytes) < MIN_SAMPLE_US) {
+        reps *= 2;
+    }
+
+    // samples kept sorted as they come in, for the median
+    unsigned int samples[BENCH_MAX_SAMPLES];
+    for (int n = 0; n < nsamples; n++) {
+        unsigned long long us = time_reps(bench, reps, &bytes);
+        unsigned int ns = us * 1000 / reps;
+        int i = n;
+        while (i > 0 && samples[i - 1] > ns) {
+            samples[i] = samples[i - 1];
+            i--;
+        }
+        samples[i] = ns;
+    }
+
+    result->reps = reps;
+    result->min_ns = samples[0];
+    result->median_ns = samples[nsamples / 2];
+    result->max_ns = samples[nsamples - 1];
+    // bytes per nanosecond is GB/s
+    result->mb_per_s = result->median_ns ? (unsigned long long) bytes * 1000 / result->median_ns : 0;
+    return true;
+}
+
+// Built in benchmarks
+
+#define SMALL 64
+#define PAGE 4096
+#define LARGE 65536
+
+static unsigned char src_buf[LARGE] __attribute__((aligned(8)));
+static unsigned char dst_buf[LARGE] __attribute__((aligned(8)));
+
+BENCH(memcpy_64, 0)
+{
+    memcpy(dst_buf, src_buf, SMALL);
+    return SMALL;
+}
+
+BENCH(memcpy_4k, 0)
+{
+    memcpy(dst_buf, src_buf, PAGE);
+    return PAGE;
+}
+
+BENCH(memcpy_64k, 0)
+{
+    memcpy(dst_buf, src_buf, LARGE);
+    return LARGE;
+}
+
+BENCH(memset_64, 0)
+{
+    memset(dst_buf, 0x55, SMALL);
+    return SMALL;
+}
+
+BENCH(memset_4k, 0)
+{
+    memset(dst_buf, 0x55, PAGE);
+    return PAGE;
+}
+
+BENCH(memset_64k, 0)
+{
+    memset(dst_buf, 0x55, LARGE);
+    return LARGE;
+}
+
+BENCH(gl_clear, BENCH_NEEDS_GL)
+{
+    gl_clear(GL_BLACK);
+    return gl_get_width() * gl_get_height() * 4;
+}
+
+BENCH(gl_draw_string, BENCH_NEEDS_GL)
+{
+    gl_draw_string(0, 0, "The quick brown fox jumps over the lazy dog", GL_WHITE);
+    return 0;
+}
+
+// allocations of mixed sizes freed in a different order than made
+BENCH(malloc_free, 0)
+{
+    void *blocks[8];
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = malloc(16 << (i % 4));
+    }
+    for (int i = 0; i < 8; i += 2) free(blocks[i]);
+    for (int i = 1; i < 8; i += 2) free(blocks[i]);
+    return 0;
+}
+
+BENCH(printf_format, 0)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%d %x %s %c %p %08d", -12345, 0xbeef, "string", 'c', buf, 42);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Micro-benchmarks run on the Pi by the shell's `bench` command.
+ *
+ * A benchmark is registered by defining it with BENCH(), anywhere in a
+ * module that gets linked in. Its body does one operation and returns
+ * the number of bytes it moved, or 0 if MB/s makes no sense for it:
+ *
+ *     BENCH(memset_4k, 0)
+ *     {
+ *         memset(buf, 0, 4096);
+ *         return 4096;
+ *     }
+ *
+ * BENCH() places a bench_t in the .bench section, which memmap gathers
+ * between __bench_start__ and __bench_end__.
+ */
+
+#include <stdbool.h>
+
+// the benchmark draws with gl, so gl_init() must have been called
+#define BENCH_NEEDS_GL (1 << 0)
+
+typedef struct {
+    const char *name;
+    unsigned int (*fn)(void);
+    unsigned int flags;
+} bench_t;
+
+#define BENCH(name, flags) \
+    static unsigned int bench_##name(void); \
+    static const bench_t bench_entry_##name \
+        __attribute__((section(".bench"), used, aligned(4))) = {#name, bench_##name, flags}; \
+    static unsigned int bench_##name(void)
+
+#define BENCH_MAX_SAMPLES 101
+
+typedef struct {
+    unsigned int reps;       // operations timed together in each sample
+    unsigned int min_ns;     // time per operation of the fastest sample
+    unsigned int median_ns;
+    unsigned int max_ns;
+    unsigned int mb_per_s;   // at the median, 0 if no bytes were moved
+} bench_result_t;
+
+int bench_count(void);
+const bench_t *bench_get(int i);
+
+/*
+ * Returns the registered benchmark called `name`, or 0.
+ */
+const bench_t *bench_find(const char *name);
+
+/*
+ * Runs `bench` after warming up and picking how many operations to
+ * time together so that each sample spans a millisecond or more of the
+ * system timer. Takes `nsamples` samples (at most BENCH_MAX_SAMPLES).
+ * Returns false if the benchmark can't run now.
+ */
+bool bench_run(const bench_t *bench, int nsamples, bench_result_t *result);
+
+#endif
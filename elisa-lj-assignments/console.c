@@ -1,39 +1,198 @@
 #include "console.h"
+#include "consoleextra.h"
 #include "gl.h"
+#include "glextra.h"
 #include "printf.h"
 #include "malloc.h"
 #include "uart.h"
 #include "strings.h"
+#include <stdbool.h>
 #include <stdarg.h>
 
 #define _WIDTH 640
 #define _HEIGHT 512
 #define MAX_OUTPUT_LEN 1024
 
+#define DEFAULT_SCROLLBACK 200
+
 unsigned int NROWS;
 unsigned int NCOLS;
+// cursor position in character cells, cursor_y == NROWS means
+// the last row ended in a newline and is waiting to scroll
 volatile unsigned int cursor_x;
 volatile unsigned int cursor_y;
-char *buf;
 
 const color_t COLOR_TEXT = GL_GREEN;
 color_t COLOR_BACKGROUND = 0;
 
+// Each cell has an attribute byte holding its colors as indices into
+// palette: the low nibble is the foreground (8-15 are the bright
+// versions of 0-7), bits 4-6 the background, and ATTR_BG_DEFAULT
+// means the cell has COLOR_BACKGROUND behind it.
+#define ATTR_FG_MASK 0x0F
+#define ATTR_BG_MASK 0x70
+#define ATTR_BG_DEFAULT 0x80
+#define ATTR_BRIGHT 0x08
+#define FG_DEFAULT 2  // green, same as COLOR_TEXT
+#define ATTR_DEFAULT (ATTR_BG_DEFAULT | FG_DEFAULT)
+static color_t palette[16];
+static unsigned char cur_attr = ATTR_DEFAULT;
+
+// State of the escape sequence parser, which may be left partway
+// through a sequence at the end of a console_printf()
+#define MAX_ESC_PARAMS 8
+enum { ESC_NONE, ESC_START, ESC_CSI };
+static int esc_state = ESC_NONE;
+static int esc_params[MAX_ESC_PARAMS];
+static int esc_nparams;
+
+static unsigned int console_mode = GL_SCROLLBUFFER;
+static unsigned int scrollback = DEFAULT_SCROLLBACK;
+
+// Text as a ring of NLINES rows of NCOLS cells. The NROWS rows on screen
+// start at top_row, and up to history_len rows before it are scrollback.
+// Scrolling reuses the oldest row as the new bottom row instead of
+// moving any text.
+static unsigned int NLINES;
+static char *cells;
+static unsigned char *attrs;
+static unsigned int top_row;
+static unsigned int history_len;
+// number of rows the view is scrolled back into history, 0 is live
+static unsigned int view_offset;
+// column the cursor was at when it left each row, for backspace
+static unsigned short *row_len;
+
+// Each buffer we draw into keeps its own dirty state, since under double
+// buffering the two buffers are brought up to date on alternate calls.
+// dirty_lo/dirty_hi are the range of columns of each row (indexed like
+// cells) not yet drawn to that buffer, and pending_scroll counts rows
+// scrolled since that buffer was last drawn.
+#define MAX_BUFFERS 2
+static unsigned short *dirty_lo[MAX_BUFFERS];
+static unsigned short *dirty_hi[MAX_BUFFERS];
+static unsigned int pending_scroll[MAX_BUFFERS];
+static unsigned int nbuffers;
+static unsigned int back_buffer;
+
 // we don't call this since shell_run runs indefinitely
 void console_free()
 {
-    free(buf);
+    free(row_len);
+}
+
+void console_set_mode(unsigned int mode)
+{
+    console_mode = mode;
+}
+
+void console_set_scrollback(unsigned int nlines)
+{
+    scrollback = nlines;
+}
+
+// helper function to find the ring index of a row on screen,
+// negative rows reach back into history
+static unsigned int ring_row(int row)
+{
+    return (top_row + NLINES + row) % NLINES;
+}
+
+// helper function to mark columns [lo, hi) of a ring row as needing a redraw
+static void mark_dirty(unsigned int r, unsigned int lo, unsigned int hi)
+{
+    for (int b = 0; b < nbuffers; b++) {
+        if (lo < dirty_lo[b][r]) dirty_lo[b][r] = lo;
+        if (hi > dirty_hi[b][r]) dirty_hi[b][r] = hi;
+    }
+}
+
+// helper function to blank a row in the ring, the pixels for it
+// must already be cleared in every buffer
+static void reset_row(unsigned int r)
+{
+    memset(cells + r * NCOLS, ' ', NCOLS);
+    memset(attrs + r * NCOLS, ATTR_DEFAULT, NCOLS);
+    row_len[r] = 0;
+    for (int b = 0; b < nbuffers; b++) {
+        dirty_lo[b][r] = NCOLS;
+        dirty_hi[b][r] = 0;
+    }
+}
+
+// helper function to have every buffer redrawn from scratch for the
+// rows currently in view, history rows outside of it are not touched
+static void invalidate_view(void)
+{
+    for (int b = 0; b < nbuffers; b++) {
+        pending_scroll[b] = NROWS;
+    }
+    for (int row = 0; row < NROWS; row++) {
+        mark_dirty(ring_row(row - (int) view_offset), 0, NCOLS);
+    }
 }
 
 void console_init(unsigned int nrows, unsigned int ncols)
 {
     //gl_init(_WIDTH, _HEIGHT, GL_DOUBLEBUFFER);
-    gl_init(ncols*gl_get_char_width(), nrows*gl_get_char_height(), GL_DOUBLEBUFFER);
+    gl_init(ncols*gl_get_char_width(), nrows*gl_get_char_height(), console_mode);
     //COLOR_BACKGROUND = gl_read_pixel(0, 0);
 
     NROWS = nrows;
     NCOLS = ncols; 
-    buf = malloc(ncols * nrows);
+    NLINES = nrows + scrollback;
+    nbuffers = (console_mode == GL_DOUBLEBUFFER) ? 2 : 1;
+    back_buffer = 0;
+
+    // all console state, scrollback included, lives in one block sized once here
+    int nshorts = NLINES * (1 + 2 * MAX_BUFFERS);
+    row_len = malloc(nshorts * sizeof(unsigned short) + 2 * NLINES * ncols);
+    for (int b = 0; b < MAX_BUFFERS; b++) {
+        dirty_lo[b] = row_len + NLINES * (1 + 2 * b);
+        dirty_hi[b] = row_len + NLINES * (2 + 2 * b);
+    }
+    cells = (char *) (row_len + nshorts);
+    attrs = (unsigned char *) (cells + NLINES * ncols);
+
+    // standard colors, then their bright versions
+    palette[0] = GL_BLACK;
+    palette[1] = gl_color(0xAA, 0, 0);
+    palette[2] = COLOR_TEXT;
+    palette[3] = gl_color(0xAA, 0x55, 0);
+    palette[4] = gl_color(0, 0, 0xAA);
+    palette[5] = gl_color(0xAA, 0, 0xAA);
+    palette[6] = gl_color(0, 0xAA, 0xAA);
+    palette[7] = gl_color(0xAA, 0xAA, 0xAA);
+    palette[8] = gl_color(0x55, 0x55, 0x55);
+    palette[9] = GL_RED;
+    palette[10] = gl_color(0x55, 0xFF, 0x55);
+    palette[11] = GL_YELLOW;
+    palette[12] = gl_color(0x55, 0x55, 0xFF);
+    palette[13] = GL_MAGENTA;
+    palette[14] = GL_CYAN;
+    palette[15] = GL_WHITE;
+    cur_attr = ATTR_DEFAULT;
+    esc_state = ESC_NONE;
+
+    console_clear();
+}
+
+static void render(void);
+
+// helper function to empty the text and scrollback, drawn by the next
+// render(). Shared by console_clear() and '\f' in console_printf().
+static void clear_text(void)
+{
+    top_row = 0;
+    history_len = 0;
+    view_offset = 0;
+    for (int r = 0; r < NLINES; r++) {
+        reset_row(r);
+    }
+    // a full screen of scrolling clears each buffer the next time it is drawn
+    for (int b = 0; b < nbuffers; b++) {
+        pending_scroll[b] = NROWS;
+    }
 
     // initialize cursor to point to top-left corner
     cursor_x = 0;
@@ -42,28 +201,319 @@ void console_init(unsigned int nrows, unsigned int ncols)
 
 void console_clear(void)
 {
-    buf[0] = '\0';
-    cursor_x = 0;
-    cursor_y = 0;
-    gl_clear(COLOR_BACKGROUND);
-    gl_swap_buffer();
-    gl_clear(COLOR_BACKGROUND);
-    gl_swap_buffer();
+    clear_text();
+    render();
 }
 
-int find_char(int ch)
+// helper function to scroll the top row off screen into history
+static void scroll(void)
 {
-    for (int i = 0; i < strlen(buf); i++) {
-        if (buf[i] == ch) return i;
+    // the row after the bottom of the screen is the oldest one in the ring
+    unsigned int new_bottom = ring_row(NROWS);
+    top_row = (top_row + 1) % NLINES;
+    if (history_len < scrollback) history_len++;
+    for (int b = 0; b < nbuffers; b++) {
+        if (pending_scroll[b] < NROWS) pending_scroll[b]++;
+    }
+    // scrolling clears the new bottom row on screen
+    reset_row(new_bottom);
+    cursor_y--;
+
+    // keep a scrolled back view on the same text
+    if (view_offset > 0 && view_offset < history_len) {
+        view_offset++;
+    }
+}
+
+// helper function to move the cursor back and erase a character
+static void backspace(void)
+{
+    if (cursor_x > 0) {
+        cursor_x--;
+        cells[ring_row(cursor_y) * NCOLS + cursor_x] = ' ';
+        attrs[ring_row(cursor_y) * NCOLS + cursor_x] = ATTR_DEFAULT;
+        mark_dirty(ring_row(cursor_y), cursor_x, cursor_x + 1);
+    } else if (cursor_y > 0) {
+        // back to where the previous row ended
+        cursor_y--;
+        cursor_x = row_len[ring_row(cursor_y)];
+    }
+}
+
+// helper function to store one printable character at the cursor
+static void put_char(char ch)
+{
+    // must wrap text around
+    if (cursor_x >= NCOLS) {
+        row_len[ring_row(cursor_y)] = NCOLS;
+        cursor_x = 0;
+        cursor_y++;
+    }
+    // scroll if at bottom of screen
+    while (cursor_y >= NROWS) {
+        scroll();
     }
-    return -1;
+    unsigned int r = ring_row(cursor_y);
+    cells[r * NCOLS + cursor_x] = ch;
+    attrs[r * NCOLS + cursor_x] = cur_attr;
+    mark_dirty(r, cursor_x, cursor_x + 1);
+    cursor_x++;
+}
+
+// helper function to bring the draw buffer up to date with the rows in view
+static void render(void)
+{
+    int b = back_buffer;
+    int char_width = gl_get_char_width();
+    int char_height = gl_get_char_height();
+
+    gl_cursor_hide();
+    if (pending_scroll[b] > 0) {
+        gl_scroll_up(pending_scroll[b] * char_height, COLOR_BACKGROUND);
+        pending_scroll[b] = 0;
+    }
+
+    // only rows with changes are touched, and only their changed columns
+    for (int row = 0; row < NROWS; row++) {
+        unsigned int r = ring_row(row - (int) view_offset);
+        int lo = dirty_lo[b][r];
+        int hi = dirty_hi[b][r];
+        if (lo >= hi) continue;
+
+        int y = row * char_height;
+        gl_draw_rect(lo * char_width, y, (hi - lo) * char_width, char_height, COLOR_BACKGROUND);
+        char *line = cells + r * NCOLS;
+        unsigned char *line_attrs = attrs + r * NCOLS;
+        for (int col = lo; col < hi; col++) {
+            unsigned char attr = line_attrs[col];
+            if (!(attr & ATTR_BG_DEFAULT)) {
+                gl_draw_rect(col * char_width, y, char_width, char_height, palette[(attr & ATTR_BG_MASK) >> 4]);
+            }
+            if (line[col] != ' ') {
+                gl_draw_char(col * char_width, y, line[col], palette[attr & ATTR_FG_MASK]);
+            }
+        }
+        dirty_lo[b][r] = NCOLS;
+        dirty_hi[b][r] = 0;
+    }
+
+    gl_cursor_show();
+
+    // the other buffer catches up from its own dirty state next time
+    if (nbuffers == 2) {
+        gl_swap_buffer();
+        back_buffer = !back_buffer;
+    }
+}
+
+// helper function to blank columns [lo, hi) of a row on screen the
+// way a terminal erases, keeping the current background color
+static void erase_cells(unsigned int row, unsigned int lo, unsigned int hi)
+{
+    unsigned int r = ring_row(row);
+    unsigned char attr = (cur_attr & (ATTR_BG_MASK | ATTR_BG_DEFAULT)) | FG_DEFAULT;
+    if (lo >= hi) return;
+    memset(cells + r * NCOLS + lo, ' ', hi - lo);
+    memset(attrs + r * NCOLS + lo, attr, hi - lo);
+    mark_dirty(r, lo, hi);
+    if (row_len[r] > lo && row_len[r] <= hi) row_len[r] = lo;
+}
+
+// helper function to apply SGR parameters to the current attribute
+static void set_graphics(void)
+{
+    // no parameters is the same as a single 0
+    if (esc_nparams == 0) {
+        cur_attr = ATTR_DEFAULT;
+    }
+    for (int i = 0; i < esc_nparams; i++) {
+        int p = esc_params[i];
+        if (p == 0) {
+            cur_attr = ATTR_DEFAULT;
+        } else if (p == 1) {
+            cur_attr |= ATTR_BRIGHT;
+        } else if (p == 22) {
+            cur_attr &= ~ATTR_BRIGHT;
+        } else if (p >= 30 && p <= 37) {
+            cur_attr = (cur_attr & ~(ATTR_FG_MASK & ~ATTR_BRIGHT)) | (p - 30);
+        } else if (p == 39) {
+            cur_attr = (cur_attr & ~ATTR_FG_MASK) | FG_DEFAULT;
+        } else if (p >= 40 && p <= 47) {
+            cur_attr = (cur_attr & ~(ATTR_BG_MASK | ATTR_BG_DEFAULT)) | ((p - 40) << 4);
+        } else if (p == 49) {
+            cur_attr = (cur_attr & ~ATTR_BG_MASK) | ATTR_BG_DEFAULT;
+        } else if (p >= 90 && p <= 97) {
+            cur_attr = (cur_attr & ~ATTR_FG_MASK) | ATTR_BRIGHT | (p - 90);
+        }
+    }
+}
+
+// helper function for the supported CSI commands that move the cursor
+// or erase from it
+static bool is_cursor_csi(char cmd)
+{
+    switch (cmd) {
+        case 'A': case 'B': case 'C': case 'D':
+        case 'H': case 'f': case 'J': case 'K':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// helper function to run a complete CSI sequence ending in `cmd`
+static void run_csi(char cmd)
+{
+    // a missing or zero count means 1 for movement
+    int n = (esc_nparams > 0 && esc_params[0] > 0) ? esc_params[0] : 1;
+    int mode = (esc_nparams > 0) ? esc_params[0] : 0;
+
+    // colors don't move the cursor, so a row waiting to wrap still wraps
+    if (cmd == 'm') {
+        set_graphics();
+        return;
+    }
+
+    // unsupported sequences are dropped
+    if (!is_cursor_csi(cmd)) return;
+
+    // the cursor must be on a real row to move or erase from it
+    while (cursor_y >= NROWS) {
+        scroll();
+    }
+    if (cursor_x >= NCOLS) cursor_x = NCOLS - 1;
+
+    switch (cmd) {
+        case 'A':
+            cursor_y = (cursor_y > n) ? cursor_y - n : 0;
+            break;
+        case 'B':
+            cursor_y = (cursor_y + n < NROWS) ? cursor_y + n : NROWS - 1;
+            break;
+        case 'C':
+            cursor_x = (cursor_x + n < NCOLS) ? cursor_x + n : NCOLS - 1;
+            break;
+        case 'D':
+            cursor_x = (cursor_x > n) ? cursor_x - n : 0;
+            break;
+        case 'H':
+        case 'f': {
+            // 1-based row;col
+            int row = (esc_nparams > 0 && esc_params[0] > 0) ? esc_params[0] : 1;
+            int col = (esc_nparams > 1 && esc_params[1] > 0) ? esc_params[1] : 1;
+            cursor_y = (row <= NROWS) ? row - 1 : NROWS - 1;
+            cursor_x = (col <= NCOLS) ? col - 1 : NCOLS - 1;
+            break;
+        }
+        case 'J':
+            if (mode == 0) {
+                erase_cells(cursor_y, cursor_x, NCOLS);
+                for (int row = cursor_y + 1; row < NROWS; row++) erase_cells(row, 0, NCOLS);
+            } else if (mode == 1) {
+                for (int row = 0; row < cursor_y; row++) erase_cells(row, 0, NCOLS);
+                erase_cells(cursor_y, 0, cursor_x + 1);
+            } else if (mode == 2) {
+                for (int row = 0; row < NROWS; row++) erase_cells(row, 0, NCOLS);
+            }
+            break;
+        case 'K':
+            if (mode == 0) {
+                erase_cells(cursor_y, cursor_x, NCOLS);
+            } else if (mode == 1) {
+                erase_cells(cursor_y, 0, cursor_x + 1);
+            } else if (mode == 2) {
+                erase_cells(cursor_y, 0, NCOLS);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// helper function to feed one character of an escape sequence to the parser
+static void parse_escape(char ch)
+{
+    if (esc_state == ESC_START) {
+        if (ch == '[') {
+            esc_state = ESC_CSI;
+            esc_nparams = 0;
+            esc_params[0] = 0;
+        } else {
+            // only CSI sequences are supported
+            esc_state = ESC_NONE;
+        }
+        return;
+    }
+
+    if (ch >= '0' && ch <= '9') {
+        if (esc_nparams == 0) esc_nparams = 1;
+        if (esc_nparams <= MAX_ESC_PARAMS) {
+            esc_params[esc_nparams - 1] = esc_params[esc_nparams - 1] * 10 + (ch - '0');
+        }
+    } else if (ch == ';') {
+        if (esc_nparams == 0) esc_nparams = 1;
+        esc_nparams++;
+        if (esc_nparams <= MAX_ESC_PARAMS) esc_params[esc_nparams - 1] = 0;
+    } else if (ch == '?') {
+        // private mode prefix, parameters are parsed and ignored
+    } else {
+        if (esc_nparams > MAX_ESC_PARAMS) esc_nparams = MAX_ESC_PARAMS;
+        run_csi(ch);
+        esc_state = ESC_NONE;
+    }
+}
+
+void console_scroll_history(int nrows)
+{
+    int offset = (int) view_offset + nrows;
+    if (offset < 0) offset = 0;
+    if (offset > history_len) offset = history_len;
+    if (offset == view_offset) return;
+
+    view_offset = offset;
+    invalidate_view();
+    render();
+}
+
+void console_page_history(int npages)
+{
+    console_scroll_history(npages * (int) NROWS);
+}
+
+void console_show_live(void)
+{
+    console_scroll_history(-(int) view_offset);
+}
+
+void console_redraw(void)
+{
+    invalidate_view();
+    render();
+}
+
+unsigned int console_get_column(void)
+{
+    return cursor_x;
+}
+
+unsigned int console_get_width(void)
+{
+    return NCOLS;
+}
+
+unsigned int console_get_row(void)
+{
+    return cursor_y;
+}
+
+char console_get_char(unsigned int row, unsigned int col)
+{
+    if (row >= NROWS || col >= NCOLS) return 0;
+    return cells[ring_row(row) * NCOLS + col];
 }
 
 int console_printf(const char *format, ...)
 {
-    gl_clear(COLOR_BACKGROUND);
-    cursor_x = 0;
-    cursor_y = 0;
     char format_buf[MAX_OUTPUT_LEN];
 
     va_list args;
@@ -72,64 +522,41 @@ int console_printf(const char *format, ...)
     int input_len = vsnprintf(format_buf, MAX_OUTPUT_LEN, format, args);
     va_end(args);
 
-    int total_len = strlcat(buf, format_buf, NROWS*NCOLS);
-
-    for (int i = 0; i < total_len; i++) {
-        char ch = buf[i];
-        if (ch == '\n') {
+    // update the cells first, then draw only what changed
+    int new_len = input_len < MAX_OUTPUT_LEN ? input_len : MAX_OUTPUT_LEN - 1;
+    for (int i = 0; i < new_len; i++) {
+        char ch = format_buf[i];
+        if (esc_state != ESC_NONE) {
+            parse_escape(ch);
+        } else if (ch == '\x1b') {
+            esc_state = ESC_START;
+        } else if (ch == '\n') {
+            // at most one row may be waiting to scroll
+            while (cursor_y >= NROWS) {
+                scroll();
+            }
+            row_len[ring_row(cursor_y)] = cursor_x;
             cursor_x = 0;
-            cursor_y += gl_get_char_height();
+            cursor_y++;
         } else if (ch == '\b') {
-            // edge case for backspace at beginning
-            if (i > 0) {
-                if (cursor_x != 0) {
-                    cursor_x -= gl_get_char_width();
-                // edge case to wrap back if at start of line
-                } else {
-                    cursor_x = (NCOLS - 1) * gl_get_char_width();
-                    cursor_y -= gl_get_char_height();
-                }
-                // draw black box to overwrite char
-                gl_draw_rect(cursor_x, cursor_y, gl_get_char_width(), gl_get_char_height(), COLOR_BACKGROUND);
-            }
+            backspace();
         } else if (ch == '\f') {
-            console_clear();
+            // drawn with the rest of the output below
+            clear_text();
         } else {
-            // must wrap text around
-            if (cursor_x >= NCOLS * gl_get_char_width()) {
-                cursor_x = 0;
-                cursor_y += gl_get_char_height();
-            }
-            // scroll if at bottom of buffer
-            if (cursor_y >= NROWS * gl_get_char_height()) {
-                // find the end of the first row
-                gl_clear(COLOR_BACKGROUND);
-                int rest_of_buf_start = find_char('\n') + 1;
-                if (rest_of_buf_start == -1 || rest_of_buf_start > NCOLS) {
-                    rest_of_buf_start = NCOLS;
-                }
-                char rest_of_buf[NCOLS*NROWS];
-                memcpy(rest_of_buf, buf + rest_of_buf_start, (strlen(buf) - rest_of_buf_start));
-                // must null-terminate
-                rest_of_buf[(strlen(buf) - rest_of_buf_start)] = '\0';
-                memcpy(buf, rest_of_buf, strlen(rest_of_buf));
-                total_len -= rest_of_buf_start;
-                buf[total_len] = '\0';
-                cursor_x = 0;
-                cursor_y = 0;
-                i = -1;
-                continue;
-            }
             // treat return char as space
             if (ch == '\r') {
                 ch = ' ';
             }
-            gl_draw_char(cursor_x, cursor_y, ch, COLOR_TEXT);
-            cursor_x += gl_get_char_width();
+            put_char(ch);
         }
     }
 
-    gl_swap_buffer();
+    // while looking at history the view stays put, the new text
+    // is drawn when the view returns to it
+    if (view_offset == 0) {
+        render();
+    }
 
     return input_len;
 }
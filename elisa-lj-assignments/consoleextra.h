@@ -0,0 +1,76 @@
+#ifndef CONSOLEEXTRA_H
+#define CONSOLEEXTRA_H
+
+/*
+ * Extensions to the library console module (console.h) implemented
+ * in console.c.
+ */
+
+#include "console.h"
+
+/*
+ * Selects the gl mode used by the next console_init(). Defaults to
+ * GL_SCROLLBUFFER, which scrolls in hardware and needs no swaps.
+ * Under GL_DOUBLEBUFFER each buffer keeps its own range of changed
+ * columns per row. A console_printf() redraws just those cells in the
+ * back buffer and swaps. The other buffer catches up from its own
+ * ranges the next time it is drawn into.
+ */
+void console_set_mode(unsigned int mode);
+
+/*
+ * Sets how many lines that scroll off the top of the screen are kept
+ * for viewing, taking effect at the next console_init() which allocates
+ * them. Defaults to 200.
+ */
+void console_set_scrollback(unsigned int nlines);
+
+/*
+ * Moves the view `nrows` rows back into the scrollback history, or
+ * forward toward the live screen if negative. Only the rows that end
+ * up in view are redrawn. Output printed while the view is scrolled
+ * back is stored but not drawn until the view returns to it.
+ */
+void console_scroll_history(int nrows);
+
+/*
+ * Same as console_scroll_history() in units of a full screen of rows.
+ */
+void console_page_history(int npages);
+
+/*
+ * Returns the view to the live screen.
+ */
+void console_show_live(void);
+
+/*
+ * Draws every row in view again, for when something else has drawn
+ * over the screen.
+ */
+void console_redraw(void);
+
+/*
+ * Returns the column the next character goes in, which is the width
+ * when a row has just been filled and the next character will wrap.
+ */
+unsigned int console_get_column(void);
+
+/*
+ * Returns the number of columns in a row.
+ */
+unsigned int console_get_width(void);
+
+/*
+ * Returns the row on the live screen the next character goes in, which
+ * is the number of rows when the last row ended in a newline and the
+ * screen will scroll before the next character.
+ */
+unsigned int console_get_row(void);
+
+/*
+ * Returns the character in column `col` of row `row` of the live
+ * screen, or 0 if the cell is off the screen.
+ */
+char console_get_char(unsigned int row, unsigned int col);
+
+#endif
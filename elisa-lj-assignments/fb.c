@@ -1,5 +1,6 @@
 #include "mailbox.h"
 #include "fb.h"
+#include "fbextra.h"
 
 // This prevents the GPU and CPU from caching mailbox messages
 #define GPU_NOCACHE 0x40000000
@@ -19,15 +20,17 @@ typedef struct {
 
 // fb is volatile because the GPU will write to it
 static volatile fb_config_t fb __attribute__ ((aligned(16)));
+static unsigned int fb_mode;
 
 void fb_init(unsigned int width, unsigned int height, unsigned int depth, unsigned int mode)
 {
     fb.width = width;
     fb.virtual_width = width;
     fb.height = height;
+    fb_mode = mode;
     if (mode == FB_SINGLEBUFFER) {
         fb.virtual_height = height;
-    } else if (mode == FB_DOUBLEBUFFER) {
+    } else if (mode == FB_DOUBLEBUFFER || mode == FB_SCROLLBUFFER) {
         fb.virtual_height = height * 2;
     }
     fb.depth = depth * 8; // convert number of bytes to number of bits
@@ -46,8 +49,8 @@ void fb_init(unsigned int width, unsigned int height, unsigned int depth, unsign
 
 void fb_swap_buffer(void)
 {
-    // if fb is not single buffer
-    if (fb.height != fb.virtual_height) {
+    // only double buffer has a second buffer to swap to
+    if (fb_mode == FB_DOUBLEBUFFER) {
         // if top buffer is drawn, switch to bottom
         if (fb.y_offset == 0) {
             fb.y_offset = fb.height;
@@ -62,7 +65,11 @@ void fb_swap_buffer(void)
 
 unsigned char* fb_get_draw_buffer(void)
 {
-    if (fb.y_offset == 0 && fb.height != fb.virtual_height) {
+    // scroll buffer draws into whatever window is visible
+    if (fb_mode == FB_SCROLLBUFFER) {
+        return (unsigned char *) (fb.framebuffer + fb.y_offset*fb.pitch);
+    }
+    if (fb.y_offset == 0 && fb_mode == FB_DOUBLEBUFFER) {
         // Abla helped me understand the arithmetic here
         return (unsigned char *) (fb.framebuffer + fb.height*fb.pitch);
     } else {
@@ -90,3 +97,27 @@ unsigned int fb_get_pitch(void)
     return fb.pitch;
 }
 
+
+unsigned int fb_get_virtual_height(void)
+{
+    return fb.virtual_height;
+}
+
+unsigned int fb_get_y_offset(void)
+{
+    return fb.y_offset;
+}
+
+void fb_set_y_offset(unsigned int y_offset)
+{
+    if (fb_mode != FB_SCROLLBUFFER || y_offset + fb.height > fb.virtual_height) return;
+
+    fb.y_offset = y_offset;
+    mailbox_write(MAILBOX_FRAMEBUFFER, (unsigned)&fb + GPU_NOCACHE);
+    (void) mailbox_read(MAILBOX_FRAMEBUFFER);
+}
+
+unsigned char* fb_get_virtual_buffer(void)
+{
+    return (unsigned char *) (fb.framebuffer);
+}
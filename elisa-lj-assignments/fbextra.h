@@ -0,0 +1,31 @@
+#ifndef FBEXTRA_H
+#define FBEXTRA_H
+
+/*
+ * Extensions to the library fb module (fb.h) implemented in fb.c.
+ *
+ * FB_SCROLLBUFFER allocates a virtual framebuffer twice the height of
+ * the display and draws directly into the visible window. Moving the
+ * window with fb_set_y_offset() scrolls the display in hardware.
+ */
+
+#include "fb.h"
+
+#define FB_SCROLLBUFFER 2
+
+unsigned int fb_get_virtual_height(void);
+unsigned int fb_get_y_offset(void);
+
+/*
+ * Moves the visible window to start at row `y_offset` of the virtual
+ * framebuffer. Only valid in FB_SCROLLBUFFER mode.
+ */
+void fb_set_y_offset(unsigned int y_offset);
+
+/*
+ * Returns the start of the whole virtual framebuffer, regardless of
+ * which part of it is currently visible or being drawn.
+ */
+unsigned char* fb_get_virtual_buffer(void);
+
+#endif
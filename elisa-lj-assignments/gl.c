@@ -1,19 +1,274 @@
 #include "gl.h"
+#include "glextra.h"
 #include "fb.h"
+#include "fbextra.h"
 #include "font.h"
 #include "strings.h"
 
 // fb will be initialized to a 4-byte depth
 const int FB_DEPTH = 4;
 
+#define CLIP_STACK_DEPTH 8
+
+// clip_stack[0] is always the full screen
+static gl_rect_t clip_stack[CLIP_STACK_DEPTH];
+static int clip_top = 0;
+// pushes refused because the stack was full, drawing is clipped to
+// nothing until each has been popped
+static int clip_overflow = 0;
+
+static unsigned int gl_mode;
+
+// The cursor is drawn on whichever buffer is being shown, with the
+// pixels it covers saved in `under` so moving it never needs a redraw
+static struct {
+    color_t sprite[GL_CURSOR_MAX_SIZE * GL_CURSOR_MAX_SIZE];
+    color_t under[GL_CURSOR_MAX_SIZE * GL_CURSOR_MAX_SIZE];
+    int w, h;              // sprite size
+    int hot_x, hot_y;      // sprite pixel placed at the position
+    int x, y;              // position
+    bool visible;          // set by gl_cursor_set_visible()
+    int hide_depth;        // gl_cursor_hide() calls not yet undone
+    unsigned *drawn_buf;   // buffer it is drawn on, 0 if not drawn
+    int x0, y0, x1, y1;    // box of that buffer saved in `under`
+} cursor;
+
+// default sprite, an arrow outlined in black
+static const char *const arrow[] = {
+    "X",
+    "XX",
+    "X.X",
+    "X..X",
+    "X...X",
+    "X....X",
+    "X.....X",
+    "X......X",
+    "X.......X",
+    "X........X",
+    "X.....XXXXX",
+    "X..X..X",
+    "X.XX..X",
+    "XX  X..X",
+    "X   X..X",
+    "     X..X",
+    "     XXX",
+};
+
 void gl_init(unsigned int width, unsigned int height, unsigned int mode)
 {
     fb_init(width, height, FB_DEPTH, mode);
+    gl_mode = mode;
+
+    clip_top = 0;
+    clip_overflow = 0;
+    clip_stack[0].x = 0;
+    clip_stack[0].y = 0;
+    clip_stack[0].w = gl_get_width();
+    clip_stack[0].h = gl_get_height();
+
+    // the framebuffer is new, so the cursor isn't drawn anywhere
+    cursor.drawn_buf = 0;
+    cursor.hide_depth = 0;
+    if (cursor.w == 0) {
+        gl_cursor_set_sprite(0, 0, 0, 0, 0);
+    }
+}
+
+// helper function to find the start of the buffer being shown
+static unsigned *shown_buffer(void)
+{
+    return (unsigned *) (fb_get_virtual_buffer() + fb_get_y_offset()*fb_get_pitch());
+}
+
+// helper function to put back the pixels under the cursor
+static void erase_cursor(void)
+{
+    if (!cursor.drawn_buf) return;
+
+    int stride = fb_get_pitch()/4;
+    const color_t *src = cursor.under;
+    for (int j = cursor.y0; j < cursor.y1; j++) {
+        unsigned *row = cursor.drawn_buf + j*stride;
+        for (int i = cursor.x0; i < cursor.x1; i++) {
+            row[i] = *src++;
+        }
+    }
+    cursor.drawn_buf = 0;
+}
+
+// helper function to save the pixels under the cursor and draw it
+static void paint_cursor(void)
+{
+    if (!cursor.visible || cursor.hide_depth > 0 || cursor.drawn_buf) return;
+
+    int x0 = cursor.x - cursor.hot_x;
+    int y0 = cursor.y - cursor.hot_y;
+    int x1 = x0 + cursor.w;
+    int y1 = y0 + cursor.h;
+    int left = x0, top = y0;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > (int) gl_get_width()) x1 = gl_get_width();
+    if (y1 > (int) gl_get_height()) y1 = gl_get_height();
+    if (x0 >= x1 || y0 >= y1) return;
+
+    unsigned *buf = shown_buffer();
+    int stride = fb_get_pitch()/4;
+    color_t *dst = cursor.under;
+    for (int j = y0; j < y1; j++) {
+        unsigned *row = buf + j*stride;
+        const color_t *sprite_row = cursor.sprite + (j - top)*cursor.w;
+        for (int i = x0; i < x1; i++) {
+            *dst++ = row[i];
+            // a zero alpha byte is transparent
+            color_t c = sprite_row[i - left];
+            if (c >> 24) {
+                row[i] = c;
+            }
+        }
+    }
+    cursor.drawn_buf = buf;
+    cursor.x0 = x0;
+    cursor.y0 = y0;
+    cursor.x1 = x1;
+    cursor.y1 = y1;
+}
+
+void gl_cursor_set_sprite(const color_t *pixels, int w, int h, int hot_x, int hot_y)
+{
+    // gl_cursor_hide() leaves a double buffered cursor up, take it off
+    // whatever the mode so the old sprite's pixels come back
+    erase_cursor();
+    if (pixels && w > 0 && h > 0 && w <= GL_CURSOR_MAX_SIZE && h <= GL_CURSOR_MAX_SIZE) {
+        memcpy(cursor.sprite, pixels, w * h * sizeof(color_t));
+        cursor.w = w;
+        cursor.h = h;
+        cursor.hot_x = hot_x;
+        cursor.hot_y = hot_y;
+    } else {
+        // anything else gets the arrow
+        cursor.h = sizeof(arrow) / sizeof(arrow[0]);
+        cursor.w = 0;
+        for (int j = 0; j < cursor.h; j++) {
+            if (strlen(arrow[j]) > cursor.w) cursor.w = strlen(arrow[j]);
+        }
+        for (int j = 0; j < cursor.h; j++) {
+            for (int i = 0; i < cursor.w; i++) {
+                char c = (i < strlen(arrow[j])) ? arrow[j][i] : ' ';
+                cursor.sprite[j*cursor.w + i] = (c == 'X') ? GL_BLACK : (c == '.') ? GL_WHITE : 0;
+            }
+        }
+        cursor.hot_x = 0;
+        cursor.hot_y = 0;
+    }
+    paint_cursor();
+}
+
+void gl_cursor_set_visible(bool visible)
+{
+    cursor.visible = visible;
+    if (visible) {
+        paint_cursor();
+    } else {
+        erase_cursor();
+    }
+}
+
+void gl_cursor_move(int x, int y)
+{
+    if (x == cursor.x && y == cursor.y) return;
+    erase_cursor();
+    cursor.x = x;
+    cursor.y = y;
+    paint_cursor();
+}
+
+void gl_cursor_hide(void)
+{
+    cursor.hide_depth++;
+    // double buffered drawing goes to the other buffer, so it can stay
+    if ((unsigned char *) cursor.drawn_buf == fb_get_draw_buffer()) {
+        erase_cursor();
+    }
+}
+
+void gl_cursor_show(void)
+{
+    if (cursor.hide_depth > 0) cursor.hide_depth--;
+    paint_cursor();
+}
+
+// helper function for the current clip, empty while a refused push
+// is outstanding so a widget never draws outside what it asked for
+static gl_rect_t current_clip(void)
+{
+    gl_rect_t clip = clip_stack[clip_top];
+    if (clip_overflow > 0) {
+        clip.w = 0;
+        clip.h = 0;
+    }
+    return clip;
+}
+
+// helper function to intersect the box [x0, x1) x [y0, y1) with
+// the current clip, returns false if nothing is left to draw
+static bool clip_box(int *x0, int *y0, int *x1, int *y1)
+{
+    gl_rect_t clip = current_clip();
+    if (*x0 < clip.x) *x0 = clip.x;
+    if (*y0 < clip.y) *y0 = clip.y;
+    if (*x1 > clip.x + clip.w) *x1 = clip.x + clip.w;
+    if (*y1 > clip.y + clip.h) *y1 = clip.y + clip.h;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+bool gl_push_clip(gl_rect_t rect)
+{
+    if (clip_top == CLIP_STACK_DEPTH - 1) {
+        clip_overflow++;
+        return false;
+    }
+
+    int x0 = rect.x;
+    int y0 = rect.y;
+    int x1 = rect.x + rect.w;
+    int y1 = rect.y + rect.h;
+    // an empty intersection is still pushed so pops stay balanced
+    if (!clip_box(&x0, &y0, &x1, &y1)) {
+        x1 = x0;
+        y1 = y0;
+    }
+
+    clip_top++;
+    clip_stack[clip_top].x = x0;
+    clip_stack[clip_top].y = y0;
+    clip_stack[clip_top].w = x1 - x0;
+    clip_stack[clip_top].h = y1 - y0;
+    return true;
+}
+
+void gl_pop_clip(void)
+{
+    // the pop matching a refused push brings back the parent's clip
+    if (clip_overflow > 0) {
+        clip_overflow--;
+    } else if (clip_top > 0) {
+        clip_top--;
+    }
+}
+
+gl_rect_t gl_get_clip(void)
+{
+    return current_clip();
 }
 
 void gl_swap_buffer(void)
 {
+    // the cursor moves over to the buffer about to be shown,
+    // leaving the new draw buffer as it was drawn
+    erase_cursor();
     fb_swap_buffer();
+    paint_cursor();
 }
 
 unsigned int gl_get_width(void) 
@@ -39,17 +294,14 @@ color_t gl_color(unsigned char r, unsigned char g, unsigned char b)
 
 void gl_clear(color_t c)
 {
-    unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
-    for (int y = 0; y < gl_get_height(); y++) {
-        for (int x = 0; x < gl_get_width(); x++) {
-            db[y][x] = c;
-        }
-    }
+    gl_rect_t clip = current_clip();
+    gl_draw_rect(clip.x, clip.y, clip.w, clip.h, c);
 }
 
 void gl_draw_pixel(int x, int y, color_t c)
 {
-    if (x < gl_get_width() && y < gl_get_height()) {
+    gl_rect_t clip = current_clip();
+    if (x >= clip.x && x < clip.x + clip.w && y >= clip.y && y < clip.y + clip.h) {
         unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
         db[y][x] = c;
     }
@@ -57,7 +309,7 @@ void gl_draw_pixel(int x, int y, color_t c)
 
 color_t gl_read_pixel(int x, int y)
 {
-    if (x < gl_get_width() && y < gl_get_height()) {
+    if (x >= 0 && x < gl_get_width() && y >= 0 && y < gl_get_height()) {
         unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
         return db[y][x];
     // out of bounds
@@ -66,30 +318,88 @@ color_t gl_read_pixel(int x, int y)
     }
 }
 
+// helper function to fill a box already known to be on screen
+static void fill_box(int x0, int y0, int x1, int y1, color_t c)
+{
+    unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
+    for (int j = y0; j < y1; j++) {
+        unsigned *row = db[j];
+        for (int i = x0; i < x1; i++) {
+            row[i] = c;
+        }
+    }
+}
+
 void gl_draw_rect(int x, int y, int w, int h, color_t c)
 {
-    for (int i = 0; i < w; i++) {
-        for (int j = 0; j < h; j++) {
-            if ((x+i < gl_get_width()) && (y+j < gl_get_height())) {
-                gl_draw_pixel(x+i, y+j, c);
+    int x0 = x, y0 = y, x1 = x + w, y1 = y + h;
+    if (clip_box(&x0, &y0, &x1, &y1)) {
+        fill_box(x0, y0, x1, y1, c);
+    }
+}
+
+void gl_scroll_up(int nlines, color_t c)
+{
+    int width = gl_get_width();
+    int height = gl_get_height();
+    if (nlines <= 0) return;
+
+    // the cursor must not scroll along with what is under it
+    gl_cursor_hide();
+    if (nlines >= height) {
+        fill_box(0, 0, width, height, c);
+        gl_cursor_show();
+        return;
+    }
+
+    if (gl_mode == GL_SCROLLBUFFER) {
+        // move the visible window down instead of moving pixels
+        unsigned int offset = fb_get_y_offset() + nlines;
+        if (offset + height > fb_get_virtual_height()) {
+            // out of room below, copy the rows that stay visible
+            // to the top of the virtual framebuffer and start over
+            unsigned char *base = fb_get_virtual_buffer();
+            memcpy(base, base + offset*fb_get_pitch(), (height - nlines)*fb_get_pitch());
+            offset = 0;
+        }
+        fb_set_y_offset(offset);
+    } else {
+        // no hardware help, move every row up in the draw buffer
+        unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
+        for (int j = 0; j < height - nlines; j++) {
+            unsigned *dst = db[j];
+            unsigned *src = db[j + nlines];
+            for (int i = 0; i < width; i++) {
+                dst[i] = src[i];
             }
         }
     }
+
+    // only the newly exposed rows need to be cleared
+    fill_box(0, height - nlines, width, height, c);
+    gl_cursor_show();
 }
 
 void gl_draw_char(int x, int y, int ch, color_t c)
 {
+    int char_width = gl_get_char_width();
+    int char_height = gl_get_char_height();
+    int x0 = x, y0 = y, x1 = x + char_width, y1 = y + char_height;
+    if (!clip_box(&x0, &y0, &x1, &y1)) return;
+
     int char_size = font_get_size();
     unsigned char inner_buf[char_size];
-    unsigned char (*buf)[gl_get_char_width()] = (unsigned char (*) [gl_get_char_width()]) inner_buf;
+    unsigned char (*buf)[char_width] = (unsigned char (*) [char_width]) inner_buf;
     // check if valid ascii character
     if (font_get_char(ch, inner_buf, char_size)) {
-        for (int i = 0; i < gl_get_char_width(); i++) {
-            for (int j = 0; j < gl_get_char_height(); j++) {
-                if ((x+i < gl_get_width()) && (y+j < gl_get_height())) {
-                    if (buf[j][i] != 0) {
-                        gl_draw_pixel(x+i, y+j, c);
-                    }
+        unsigned (*db)[fb_get_pitch()/4] = (unsigned (*)[fb_get_pitch()/4]) fb_get_draw_buffer();
+        // only walk the part of the glyph inside the clip
+        for (int j = y0; j < y1; j++) {
+            unsigned char *glyph_row = buf[j - y];
+            unsigned *row = db[j];
+            for (int i = x0; i < x1; i++) {
+                if (glyph_row[i - x] != 0) {
+                    row[i] = c;
                 }
             }
         }
@@ -98,11 +408,19 @@ void gl_draw_char(int x, int y, int ch, color_t c)
 
 void gl_draw_string(int x, int y, char* str, color_t c)
 {
+    gl_rect_t clip = current_clip();
+    int char_width = gl_get_char_width();
+    // whole string is above or below the clip
+    if (y + (int) gl_get_char_height() <= clip.y || y >= clip.y + clip.h) return;
+
     int len = strlen(str);
-    int char_width = gl_get_char_width(); 
     for (int i = 0; i < len; i++) {
-        int ch = str[i];
-        gl_draw_char(x + (char_width * i), y, ch, c);
+        int char_x = x + (char_width * i);
+        // rest of string is right of the clip
+        if (char_x >= clip.x + clip.w) break;
+        // skip characters left of the clip
+        if (char_x + char_width <= clip.x) continue;
+        gl_draw_char(char_x, y, str[i], c);
     }
 }
 
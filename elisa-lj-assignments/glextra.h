@@ -0,0 +1,83 @@
+#ifndef GLEXTRA_H
+#define GLEXTRA_H
+
+/*
+ * Extensions to the library gl module (gl.h) implemented in gl.c.
+ *
+ * All gl drawing primitives clip against the rectangle on top of the
+ * clip stack. The bottom entry is always the full screen and is reset
+ * by gl_init(). Pushing a rectangle intersects it with the current
+ * clip, so a widget can never draw outside of its parent's region.
+ */
+
+#include "gl.h"
+#include "fbextra.h"
+#include <stdbool.h>
+
+// draws straight into the visible window, see gl_scroll_up()
+#define GL_SCROLLBUFFER FB_SCROLLBUFFER
+
+typedef struct {
+    int x, y;   // upper left corner
+    int w, h;   // width and height in pixels
+} gl_rect_t;
+
+/*
+ * Push `rect` (intersected with the current clip) onto the clip stack.
+ * Returns false if the stack is full. Nothing is drawn from then until
+ * the matching gl_pop_clip(), so pops stay balanced and a widget still
+ * never draws outside the rectangle it asked for.
+ */
+bool gl_push_clip(gl_rect_t rect);
+
+/*
+ * Pop the most recently pushed clip rectangle, or just account for a
+ * push that was refused. Popping the full screen entry at the bottom of
+ * the stack does nothing.
+ */
+void gl_pop_clip(void);
+
+/*
+ * Returns the current clip rectangle.
+ */
+gl_rect_t gl_get_clip(void);
+
+/*
+ * Scrolls the whole screen up by `nlines` pixel rows and fills the
+ * newly exposed rows at the bottom with color `c`. In GL_SCROLLBUFFER
+ * mode this moves the framebuffer's virtual offset, so it only costs
+ * clearing the new rows plus an occasional copy when the window
+ * reaches the end of the virtual framebuffer. Ignores the clip stack.
+ */
+void gl_scroll_up(int nlines, color_t c);
+
+/*
+ * Mouse cursor overlay. The cursor is drawn over the buffer being
+ * shown, saving the pixels it covers so moving it only restores those
+ * and saves the ones at the new spot. gl_swap_buffer() and
+ * gl_scroll_up() keep it on screen.
+ *
+ * Drawing on the shown buffer under the cursor (anything but
+ * GL_DOUBLEBUFFER) must be bracketed with gl_cursor_hide() and
+ * gl_cursor_show(), or the old pixels come back when the cursor moves.
+ */
+#define GL_CURSOR_MAX_SIZE 32
+
+/*
+ * Sets the cursor image to the `w` by `h` `pixels`, where pixels with
+ * a zero alpha byte are transparent, and (`hot_x`, `hot_y`) is the pixel
+ * placed at the cursor position. A null `pixels` or one larger than
+ * GL_CURSOR_MAX_SIZE sets the default arrow.
+ */
+void gl_cursor_set_sprite(const color_t *pixels, int w, int h, int hot_x, int hot_y);
+
+void gl_cursor_set_visible(bool visible);
+void gl_cursor_move(int x, int y);
+
+/*
+ * Lift the cursor off the screen while drawing, calls can nest.
+ */
+void gl_cursor_hide(void);
+void gl_cursor_show(void);
+
+#endif
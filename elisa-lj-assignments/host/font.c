@@ -0,0 +1,40 @@
+/*
+ * Host stand-in for the library font module. The real font data only
+ * ships in libpi, so glyphs here are generated from the bits of the
+ * character code. They have the same size as the default font and a
+ * similar number of set pixels, which is what drawing cost depends on.
+ */
+
+#include "font.h"
+
+#define FONT_WIDTH 14
+#define FONT_HEIGHT 16
+
+size_t font_get_height(void)
+{
+    return FONT_HEIGHT;
+}
+
+size_t font_get_width(void)
+{
+    return FONT_WIDTH;
+}
+
+size_t font_get_size(void)
+{
+    return FONT_WIDTH * FONT_HEIGHT;
+}
+
+bool font_get_char(char ch, unsigned char buf[], size_t buflen)
+{
+    if (ch < ' ' || ch > '~' || buflen < font_get_size()) return false;
+
+    for (int y = 0; y < FONT_HEIGHT; y++) {
+        for (int x = 0; x < FONT_WIDTH; x++) {
+            // space is blank, everything else gets a pattern unique to it
+            int bit = ((ch * (y + 1)) >> (x % 7)) & 1;
+            buf[y * FONT_WIDTH + x] = (ch != ' ' && bit) ? 0xFF : 0;
+        }
+    }
+    return true;
+}
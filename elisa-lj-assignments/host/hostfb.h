@@ -0,0 +1,32 @@
+#ifndef HOSTFB_H
+#define HOSTFB_H
+
+/*
+ * Inspecting the framebuffer emulated by host/mailbox.c, for native
+ * tests and benchmarks of gl and console.
+ */
+
+#include <stdbool.h>
+
+/*
+ * Writes the frame the GPU would currently be showing, the window of
+ * the virtual framebuffer starting at y_offset, to `path` as a binary
+ * PPM. Returns false if nothing has been allocated or the file could
+ * not be written.
+ */
+bool hostfb_dump_ppm(const char *path);
+
+/*
+ * Compares the frame currently shown against the PPM at `path`.
+ * Returns the number of pixels that differ, or -1 if the file could
+ * not be read or its size does not match.
+ */
+int hostfb_compare_ppm(const char *path);
+
+/*
+ * Number of framebuffer requests the GPU has answered, each one a
+ * mailbox round trip on the Pi (fb_init, swaps and scrolls).
+ */
+unsigned int hostfb_get_request_count(void);
+
+#endif
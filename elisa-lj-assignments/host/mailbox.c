@@ -0,0 +1,171 @@
+/*
+ * Host stand-in for the library mailbox module that plays the part of
+ * the GPU for the framebuffer channel, so the real fb.c can run natively.
+ *
+ * A framebuffer request is answered the way the firmware does: the
+ * first request (or one asking for a new size) allocates the virtual
+ * framebuffer and fills in pitch, framebuffer and size, and every
+ * request moves the visible window to y_offset.
+ *
+ * fb.c passes its config and framebuffer as 32-bit addresses, so host
+ * builds link with -no-pie to keep statics below 4GB and framebuffer
+ * memory is mapped with MAP_32BIT.
+ */
+
+#define _GNU_SOURCE  // for MAP_32BIT
+#include "mailbox.h"
+#include "hostfb.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// This prevents the GPU and CPU from caching mailbox messages
+#define GPU_NOCACHE 0x40000000
+// The firmware pads rows, do the same so pitch bugs show up here too
+#define PITCH_ALIGN 64
+
+// Same layout as the message in fb.c, defined by the firmware
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  unsigned int virtual_width;
+  unsigned int virtual_height;
+  unsigned int pitch;
+  unsigned int depth;
+  unsigned int x_offset;
+  unsigned int y_offset;
+  unsigned int framebuffer;
+  unsigned int size;
+} fb_config_t;
+
+// what the emulated GPU is currently scanning out
+static fb_config_t gpu;
+static unsigned char *memory;
+static unsigned int requests;
+
+static unsigned int responses[MAILBOX_MAXCHANNEL];
+
+// helper function to answer a framebuffer request in place
+static unsigned int framebuffer_request(volatile fb_config_t *msg)
+{
+    requests++;
+
+    bool resize = memory == NULL ||
+        msg->width != gpu.width || msg->height != gpu.height ||
+        msg->virtual_width != gpu.virtual_width ||
+        msg->virtual_height != gpu.virtual_height ||
+        msg->depth != gpu.depth;
+
+    if (resize) {
+        if (memory) munmap(memory, gpu.size);
+        gpu.width = msg->width;
+        gpu.height = msg->height;
+        gpu.virtual_width = msg->virtual_width;
+        gpu.virtual_height = msg->virtual_height;
+        gpu.depth = msg->depth;
+        gpu.pitch = (gpu.virtual_width * gpu.depth / 8 + PITCH_ALIGN - 1) & ~(PITCH_ALIGN - 1);
+        gpu.size = gpu.pitch * gpu.virtual_height;
+        memory = mmap(NULL, gpu.size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+        if (memory == MAP_FAILED) {
+            memory = NULL;
+            return 1;
+        }
+        gpu.framebuffer = (unsigned int) (uintptr_t) memory;
+    }
+
+    // the firmware ignores offsets that would show past the end
+    if (msg->y_offset + gpu.height <= gpu.virtual_height) {
+        gpu.y_offset = msg->y_offset;
+    }
+    gpu.x_offset = msg->x_offset;
+
+    msg->pitch = gpu.pitch;
+    msg->framebuffer = gpu.framebuffer;
+    msg->size = gpu.size;
+    return 0;
+}
+
+void mailbox_write(unsigned int channel, unsigned int addr)
+{
+    if (channel >= MAILBOX_MAXCHANNEL) return;
+
+    if (channel == MAILBOX_FRAMEBUFFER) {
+        volatile fb_config_t *msg = (fb_config_t *) (uintptr_t) (addr - GPU_NOCACHE);
+        // the response carries the channel in the low bits like the real mailbox
+        responses[channel] = (framebuffer_request(msg) << 4) | channel;
+    } else {
+        responses[channel] = channel;
+    }
+}
+
+unsigned int mailbox_read(unsigned int channel)
+{
+    if (channel >= MAILBOX_MAXCHANNEL) return 0;
+    return responses[channel] >> 4;
+}
+
+// helper function to find a pixel of the frame being shown
+static unsigned int shown_pixel(int x, int y)
+{
+    unsigned int *row = (unsigned int *) (memory + (gpu.y_offset + y) * gpu.pitch);
+    return row[x];
+}
+
+bool hostfb_dump_ppm(const char *path)
+{
+    if (!memory) return false;
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+
+    fprintf(fp, "P6\n%u %u\n255\n", gpu.width, gpu.height);
+    for (int y = 0; y < gpu.height; y++) {
+        for (int x = 0; x < gpu.width; x++) {
+            unsigned int c = shown_pixel(x, y);
+            fputc((c >> 16) & 0xFF, fp);
+            fputc((c >> 8) & 0xFF, fp);
+            fputc(c & 0xFF, fp);
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+int hostfb_compare_ppm(const char *path)
+{
+    if (!memory) return -1;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    unsigned int width, height, maxval;
+    if (fscanf(fp, "P6 %u %u %u", &width, &height, &maxval) != 3 ||
+        fgetc(fp) == EOF || width != gpu.width || height != gpu.height) {
+        fclose(fp);
+        return -1;
+    }
+
+    int ndiff = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int r = fgetc(fp);
+            int g = fgetc(fp);
+            int b = fgetc(fp);
+            if (b == EOF) {
+                fclose(fp);
+                return -1;
+            }
+            unsigned int c = shown_pixel(x, y);
+            if (r != ((c >> 16) & 0xFF) || g != ((c >> 8) & 0xFF) || b != (c & 0xFF)) {
+                ndiff++;
+            }
+        }
+    }
+    fclose(fp);
+    return ndiff;
+}
+
+unsigned int hostfb_get_request_count(void)
+{
+    return requests;
+}
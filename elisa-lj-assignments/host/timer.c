@@ -0,0 +1,39 @@
+/*
+ * Host stand-in for timer.c, ticks are microseconds of CLOCK_MONOTONIC
+ * truncated to 32 bits like the Pi's system timer.
+ */
+
+// for clock_gettime under -std=c99
+#define _POSIX_C_SOURCE 199309L
+
+#include "timer.h"
+#include "timerextra.h"
+#include <time.h>
+
+void timer_init(void) {
+}
+
+unsigned int timer_get_ticks(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned int) (now.tv_sec * 1000000ULL + now.tv_nsec / 1000);
+}
+
+unsigned long long timer_get_ticks64(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+void timer_delay_us(unsigned int usecs) {
+    unsigned int start = timer_get_ticks();
+    while (timer_get_ticks() - start < usecs) { /* spin */ }
+}
+
+void timer_delay_ms(unsigned int msecs) {
+    timer_delay_us(1000*msecs);
+}
+
+void timer_delay(unsigned int secs) {
+    timer_delay_us(1000000*secs);
+}
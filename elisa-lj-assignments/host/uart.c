@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for the library uart module, uart output goes to stdout.
+ */
+
+#include "uart.h"
+#include <stdio.h>
+
+void uart_init(void)
+{
+}
+
+int uart_getchar(void)
+{
+    return getchar();
+}
+
+int uart_putchar(int ch)
+{
+    return putchar(ch);
+}
+
+void uart_flush(void)
+{
+    fflush(stdout);
+}
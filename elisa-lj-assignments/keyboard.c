@@ -1,74 +1,443 @@
 #include "gpio.h"
 #include "gpioextra.h"
 #include "keyboard.h"
+#include "keyboardextra.h"
 #include "ps2.h"
+#include "ps2decoder.h"
+#include "ps2writer.h"
 #include "strings.h"
 #include "printf.h"
 #include "interrupts.h"
 #include "ringbuffer.h"
+#include "ringbufferextra.h"
+#include "timer.h"
+
+// Take clock edges as FIQ (keyboard_fiq.s) instead of through the shared
+// IRQ handler chain, so long stretches with IRQs off don't drop bits
+#define KEYBOARD_USE_FIQ 1
 
 const unsigned int CLK  = GPIO_PIN23;
 const unsigned int DATA = GPIO_PIN24;
 
+#define GPIO_BASE 0x20200000
+#define FIQ_CONTROL ((volatile unsigned int *) 0x2000B20C)
+#define FIQ_ENABLE (1 << 7)
+#define FIQ_VECTOR ((volatile unsigned int *) 0x1C)
+#define GPIO_EVENTS ((volatile unsigned int *) (GPIO_BASE + 0x40))
+
+// system timer compare 1 wakes timed waits, see wait_for_scancode()
+#define SYSTIMER_CS ((volatile unsigned int *) 0x20003000)
+#define SYSTIMER_C1 ((volatile unsigned int *) 0x20003010)
+#define SYSTIMER_M1 (1 << 1)
+#define IRQ_ENABLE_1 ((volatile unsigned int *) 0x2000B210)
+#define IRQ_DISABLE_1 ((volatile unsigned int *) 0x2000B21C)
+#define CPSR_IRQ_FIQ_MASK 0xC0
+
+extern void keyboard_fiq_init(unsigned int gpio_base);
+extern void keyboard_fiq_enable(void);
+extern void keyboard_fiq_handler(void);
+
+// Every pin on the bank raises the same GPIO interrupt, so while it is
+// routed to FIQ, events on pins other than CLK are handed to this
+static bool using_fiq = false;
+static void (*gpio_fiq_chain)(unsigned int pc) = 0;
+
 // variables for interrupt handling
 static rb_t* rb;
-static int cnt = 0;
-static unsigned char int_scancode = 0;
-static unsigned int ones_in_data = 0;
+static ps2_decoder_t decoder;
+
+// time each edge of the current frame was handled, filled in by
+// both the IRQ and FIQ handler, and the worst lateness seen so far
+#define FRAME_BITS 11
+unsigned int keyboard_edge_times[FRAME_BITS];
+static unsigned int worst_latency = 0;
 
 // global to save states of modifiers
 static unsigned int modifiers = 0;
+// a lock toggled since the LEDs were last set, see keyboard_read_sequence()
+static bool leds_pending = false;
+
+// Each ring entry is the scancode in the low byte, stamped above it with
+// the low 24 bits of the tick its last clock edge came in (16 s range)
+#define STAMP_SHIFT 8
+#define STAMP_MASK 0xFFFFFF
+
+// ticks of the scancode ending the last sequence consumed, when it was
+// consumed, and the latencies seen between those and the echo
+static unsigned int event_stamp = 0;
+static unsigned int consumed_ticks = 0;
+static keyboard_latency_t queue_latency;
+static keyboard_latency_t echo_latency;
+
+// Decoding is done by lookups in tables built by build_tables() for
+// the scan code set in use. Every scancode past the end of the library's
+// ps2_keys, which is set 2, decodes to no key unless set 3 defines it.
+#define PS2_KEYS_LEN 0x84
+#define NUM_SCANCODES 0x85
+static int scancode_set = 2;
+
+// indexed by [extended][scancode]
+static ps2_key_t key_table[2][NUM_SCANCODES];
+static unsigned char modifier_table[2][NUM_SCANCODES];
+
+// character typed, indexed by [extended][CHAR_PLANE(modifiers)][scancode]
+// CAPS_LOCK and SHIFT are adjacent bits, so they pick one of four planes
+#define CHAR_PLANE(mods) (((mods) >> 2) & 3)
+static unsigned char char_table[2][4][NUM_SCANCODES];
+
+#define LOCK_MODIFIERS (KEYBOARD_MOD_SCROLL_LOCK | KEYBOARD_MOD_NUM_LOCK | KEYBOARD_MOD_CAPS_LOCK)
+
+// keys sent with a PS2_CODE_EXTEND prefix. The page keys share codes with
+// the keypad, the console uses them to page through its scrollback.
+static const struct {
+    unsigned char code;
+    unsigned char ch;
+} extended_keys[] = {
+    {0x11, PS2_KEY_ALT},
+    {0x14, PS2_KEY_CTRL},
+    {0x4A, '/'},
+    {0x5A, PS2_KEY_ENTER},
+    {0x69, PS2_KEY_END},
+    {0x6B, PS2_KEY_ARROW_LEFT},
+    {0x6C, PS2_KEY_HOME},
+    {0x70, PS2_KEY_INSERT},
+    {0x71, PS2_KEY_DELETE},
+    {0x72, PS2_KEY_ARROW_DOWN},
+    {0x74, PS2_KEY_ARROW_RIGHT},
+    {0x75, PS2_KEY_ARROW_UP},
+    {0x7A, PS2_KEY_PAGE_DOWN},
+    {0x7D, PS2_KEY_PAGE_UP},
+};
+
+// Scan code set 3 shares the codes of the main block of keys with set 2.
+// These are the keys that differ; it has no extended keys at all.
+static const struct {
+    unsigned char code;
+    unsigned char ch;
+} set3_keys[] = {
+    {0x07, PS2_KEY_F1}, {0x0F, PS2_KEY_F2}, {0x17, PS2_KEY_F3}, {0x1F, PS2_KEY_F4},
+    {0x27, PS2_KEY_F5}, {0x2F, PS2_KEY_F6}, {0x37, PS2_KEY_F7}, {0x3F, PS2_KEY_F8},
+    {0x47, PS2_KEY_F9}, {0x4F, PS2_KEY_F10}, {0x56, PS2_KEY_F11}, {0x5E, PS2_KEY_F12},
+    {0x08, PS2_KEY_ESC},
+    {0x11, PS2_KEY_CTRL}, {0x58, PS2_KEY_CTRL},
+    {0x19, PS2_KEY_ALT}, {0x39, PS2_KEY_ALT},
+    {0x14, PS2_KEY_CAPS_LOCK}, {0x76, PS2_KEY_NUM_LOCK}, {0x5F, PS2_KEY_SCROLL_LOCK},
+    {0x67, PS2_KEY_INSERT}, {0x64, PS2_KEY_DELETE},
+    {0x6E, PS2_KEY_HOME}, {0x65, PS2_KEY_END},
+    {0x6F, PS2_KEY_PAGE_UP}, {0x6D, PS2_KEY_PAGE_DOWN},
+    {0x63, PS2_KEY_ARROW_UP}, {0x60, PS2_KEY_ARROW_DOWN},
+    {0x61, PS2_KEY_ARROW_LEFT}, {0x6A, PS2_KEY_ARROW_RIGHT},
+    {0x77, '/'}, {0x7E, '*'}, {0x84, '-'}, {0x7C, '+'}, {0x79, PS2_KEY_ENTER},
+};
+
+// set 2 codes of keys that moved in set 3, which mean nothing there
+static const unsigned char set2_only_codes[] = {
+    0x01, 0x03, 0x04, 0x05, 0x06, 0x09, 0x0A, 0x0B, 0x0C, 0x78, 0x7B, 0x83,
+};
+
+// keyboard commands, sent with send_command()
+#define CMD_SET_LEDS 0xED
+#define CMD_SCANCODE_SET 0xF0
+#define CMD_TYPEMATIC 0xF3
+#define CMD_ENABLE 0xF4
+#define CMD_ALL_TYPEMATIC 0xF7
+#define CMD_KEYS_MAKE_BREAK 0xFC
+#define CMD_KEYS_MAKE_ONLY 0xFD
+
+// typematic rates the keyboard supports, in tenths of a
+// character per second, indexed by their code
+static const unsigned short typematic_rates[32] = {
+    300, 267, 240, 218, 200, 185, 171, 160, 150, 133, 120, 109, 100, 92, 86, 80,
+    75, 67, 60, 55, 50, 46, 43, 40, 37, 33, 30, 27, 25, 23, 21, 20,
+};
+
+// bytes of a sequence that has only partly arrived, kept
+// between calls so the non-blocking readers never lose them
+static unsigned char partial_seq[3];
+static int partial_len = 0;
 
 void wait_for_falling_clock_edge() {
     while (gpio_read(CLK) == 0) {}
     while (gpio_read(CLK) == 1) {}
 }
 
+// helper function to estimate how late the worst edge of the frame just
+// read was handled. The keyboard clocks bits at a steady rate, so the
+// ideal time of each edge is on the line from the first edge to the last.
+// Lateness is measured from the edge that came earliest relative to it.
+static void record_frame_latency(void)
+{
+    unsigned int span = keyboard_edge_times[FRAME_BITS - 1] - keyboard_edge_times[0];
+    int earliest = 0;
+    int latest = 0;
+    for (int i = 1; i < FRAME_BITS - 1; i++) {
+        int offset = (int) (keyboard_edge_times[i] - keyboard_edge_times[0]) -
+                     (int) (span * i / (FRAME_BITS - 1));
+        if (offset < earliest) earliest = offset;
+        if (offset > latest) latest = offset;
+    }
+    if (latest - earliest > worst_latency) {
+        worst_latency = latest - earliest;
+    }
+}
+
+// called with a complete frame by either handler
+void keyboard_frame_done(unsigned int scancode, unsigned int stop_bit)
+{
+    record_frame_latency();
+    // check that stop bit is high, otherwise drop it
+    if (stop_bit == 1) {
+        unsigned int stamp = keyboard_edge_times[FRAME_BITS - 1] & STAMP_MASK;
+        rb_enqueue(rb, (stamp << STAMP_SHIFT) | scancode);
+    }
+}
+
+// helper function to add one latency to a histogram
+static void record_latency(keyboard_latency_t *hist, unsigned int us)
+{
+    int bucket = 0;
+    while (bucket < KEYBOARD_LATENCY_BUCKETS - 1 && (us >> bucket) > 1) {
+        bucket++;
+    }
+    hist->counts[bucket]++;
+    hist->total++;
+    if (us > hist->max) hist->max = us;
+}
+
+const keyboard_latency_t *keyboard_get_queue_latency(void)
+{
+    return &queue_latency;
+}
+
+const keyboard_latency_t *keyboard_get_echo_latency(void)
+{
+    return &echo_latency;
+}
+
+void keyboard_reset_latency(void)
+{
+    memset(&queue_latency, 0, sizeof(queue_latency));
+    memset(&echo_latency, 0, sizeof(echo_latency));
+}
+
+unsigned int keyboard_get_event_ticks(void)
+{
+    return event_stamp;
+}
+
+void keyboard_record_echo(void)
+{
+    record_latency(&echo_latency, timer_get_ticks() - consumed_ticks);
+}
+
+// called from the FIQ handler when pins other than CLK have events
+void keyboard_fiq_other(unsigned int events)
+{
+    if (gpio_fiq_chain) {
+        gpio_fiq_chain(0);
+        // the chained handler clears only its own pins, and a stray
+        // event on any other would keep the FIQ firing forever
+        events = *GPIO_EVENTS;
+    }
+    // nobody wants the rest, clear them or the FIQ would never end
+    *GPIO_EVENTS = events & ~(1 << CLK);
+}
+
+bool keyboard_attach_gpio_handler(void (*fn)(unsigned int pc))
+{
+    if (!using_fiq) return false;
+    gpio_fiq_chain = fn;
+    return true;
+}
+
+unsigned int keyboard_get_edge_latency(void)
+{
+    return worst_latency;
+}
+
+void keyboard_reset_edge_latency(void)
+{
+    worst_latency = 0;
+}
+
 void interrupt_handler(unsigned int pc)
 {
     // interrupt called for each falling clock edge
     if (gpio_check_and_clear_event(CLK)) {
-        // checking for start bit
-        if (cnt == 0 && gpio_read(DATA) == 0) {
-            cnt++;
-            return;
+        unsigned int ticks = timer_get_ticks();
+        if (decoder.cnt < FRAME_BITS) {
+            keyboard_edge_times[decoder.cnt] = ticks;
         }
-        // check parity
-        if (cnt == 9) {
-            unsigned int parity = gpio_read(DATA);
-            // if even parity, reset count
-            if ((parity + ones_in_data) % 2 == 0) {
-                cnt = 0;
-                ones_in_data = 0;
-                int_scancode = 0;
-                return;
-            }
+        unsigned char scancode;
+        ps2_decoder_result_t result = ps2_decoder_edge(&decoder, gpio_read(DATA), ticks, &scancode);
+        if (result != PS2_DECODER_BUSY) {
+            keyboard_frame_done(scancode, result == PS2_DECODER_FRAME);
         }
-        // only enqueue when full scancode has read
-        if (cnt == 10) {
-            // check that stop bit is high, otherwise reset
-            if (gpio_read(DATA) == 1) {
-                rb_enqueue(rb, int_scancode);
-            }
-            cnt = 0;
-            ones_in_data = 0;
-            int_scancode = 0;
-            return;
+    }
+}
+
+// helper function to find the modifier bit a key sets, if any
+static unsigned char modifier_bit(unsigned char ch)
+{
+    switch (ch) {
+        case PS2_KEY_SCROLL_LOCK: return KEYBOARD_MOD_SCROLL_LOCK;
+        case PS2_KEY_NUM_LOCK: return KEYBOARD_MOD_NUM_LOCK;
+        case PS2_KEY_CAPS_LOCK: return KEYBOARD_MOD_CAPS_LOCK;
+        case PS2_KEY_SHIFT: return KEYBOARD_MOD_SHIFT;
+        case PS2_KEY_ALT: return KEYBOARD_MOD_ALT;
+        case PS2_KEY_CTRL: return KEYBOARD_MOD_CTRL;
+        default: return 0;
+    }
+}
+
+// helper function to fill in the character planes of one key. Shift picks
+// the other character. Caps lock only does for letters and shift undoes it.
+static void build_chars(int extended, unsigned char code)
+{
+    ps2_key_t key = key_table[extended][code];
+    bool is_letter = (key.ch >= 'a' && key.ch <= 'z');
+    unsigned char shifted = key.other_ch ? key.other_ch : key.ch;
+
+    for (int plane = 0; plane < 4; plane++) {
+        bool has_shift = (plane << 2) & KEYBOARD_MOD_SHIFT;
+        bool has_caps_lock = (plane << 2) & KEYBOARD_MOD_CAPS_LOCK;
+        bool use_shifted = is_letter ? (has_shift != has_caps_lock) : has_shift;
+
+        if (modifier_table[extended][code]) {
+            char_table[extended][plane][code] = 0;
+        } else {
+            char_table[extended][plane][code] = use_shifted ? shifted : key.ch;
         }
-        // otherwise, read data
-        int data_bit = gpio_read(DATA);
-        int_scancode |= data_bit << (cnt - 1);
-        ones_in_data += data_bit;
-        cnt++;
     }
 }
 
+// helper function to build the decoding tables from the library's ps2_keys
+static void build_tables(void)
+{
+    memset(key_table, 0, sizeof(key_table));
+    for (int code = 0; code < PS2_KEYS_LEN; code++) {
+        key_table[0][code] = ps2_keys[code];
+    }
+    for (int i = 0; i < sizeof(extended_keys) / sizeof(extended_keys[0]); i++) {
+        key_table[1][extended_keys[i].code].ch = extended_keys[i].ch;
+    }
+    if (scancode_set == 3) {
+        for (int i = 0; i < sizeof(set2_only_codes); i++) {
+            key_table[0][set2_only_codes[i]].ch = PS2_KEY_NONE;
+            key_table[0][set2_only_codes[i]].other_ch = 0;
+        }
+        for (int i = 0; i < sizeof(set3_keys) / sizeof(set3_keys[0]); i++) {
+            key_table[0][set3_keys[i].code].ch = set3_keys[i].ch;
+            key_table[0][set3_keys[i].code].other_ch = 0;
+        }
+    }
+
+    for (int extended = 0; extended < 2; extended++) {
+        for (int code = 0; code < NUM_SCANCODES; code++) {
+            modifier_table[extended][code] = modifier_bit(key_table[extended][code].ch);
+            build_chars(extended, code);
+        }
+    }
+}
+
+// helper function to queue a scancode that arrived while a command was
+// waiting for its acknowledge, as the receive handler would have
+static void queue_scancode(unsigned char scancode)
+{
+    unsigned int stamp = timer_get_ticks() & STAMP_MASK;
+    rb_enqueue(rb, (stamp << STAMP_SHIFT) | scancode);
+}
+
+// helper function to send a command and its argument bytes, each of
+// which the keyboard acknowledges. Clock edge detection is off meanwhile
+// so the receive handler doesn't decode the exchange; a frame it was in
+// the middle of is dropped on its next edge by the decoder's resync.
+// Keystrokes read while waiting for an acknowledge are queued.
+static bool send_command(const unsigned char bytes[], int n)
+{
+    gpio_disable_event_detection(CLK, GPIO_DETECT_FALLING_EDGE);
+    bool ok = true;
+    for (int i = 0; i < n && ok; i++) {
+        ok = ps2_command(CLK, DATA, bytes[i], queue_scancode);
+    }
+    gpio_clear_event(CLK);
+    gpio_enable_event_detection(CLK, GPIO_DETECT_FALLING_EDGE);
+    return ok;
+}
+
+bool keyboard_set_leds(unsigned int leds)
+{
+    // the LED bits are in the same order as the lock modifiers
+    unsigned char command[] = {CMD_SET_LEDS, leds & LOCK_MODIFIERS};
+    return send_command(command, sizeof(command));
+}
+
+bool keyboard_set_typematic(unsigned int delay_ms, unsigned int rate_cps)
+{
+    // delays are 250 ms to 1 s in steps of 250 ms
+    int delay = (delay_ms + 125) / 250 - 1;
+    if (delay < 0) delay = 0;
+    if (delay > 3) delay = 3;
+
+    int rate = 0;
+    for (int i = 1; i < 32; i++) {
+        int diff = typematic_rates[i] - (int) rate_cps * 10;
+        int best = typematic_rates[rate] - (int) rate_cps * 10;
+        if (diff * diff < best * best) rate = i;
+    }
+
+    unsigned char command[] = {CMD_TYPEMATIC, (delay << 5) | rate};
+    return send_command(command, sizeof(command));
+}
+
+bool keyboard_set_scancode_set(int set)
+{
+    // In set 3 every key repeats without break codes, except modifiers
+    // which also send breaks and locks which send one make only, so a
+    // key press is a single scancode to decode
+    static const unsigned char set3[] = {
+        CMD_SCANCODE_SET, 3,
+        CMD_ALL_TYPEMATIC,
+        CMD_KEYS_MAKE_BREAK, 0x12, 0x59, 0x11, 0x58, 0x19, 0x39,
+        CMD_KEYS_MAKE_ONLY, 0x14, 0x76, 0x5F,
+        CMD_ENABLE,
+    };
+    static const unsigned char set2[] = {CMD_SCANCODE_SET, 2};
+
+    if (set != 2 && set != 3) return false;
+    bool ok = (set == 3) ? send_command(set3, sizeof(set3)) : send_command(set2, sizeof(set2));
+    if (!ok && set == 3) {
+        // not every keyboard has set 3, go back to the default
+        send_command(set2, sizeof(set2));
+        set = 2;
+    }
+
+    scancode_set = set;
+    partial_len = 0;
+    build_tables();
+    return ok;
+}
+
 void setup_interrupts(void)
 {
     gpio_enable_event_detection(CLK, GPIO_DETECT_FALLING_EDGE);
+#if KEYBOARD_USE_FIQ
+    keyboard_fiq_init(GPIO_BASE);
+    // The vector at 0x1C is the first instruction of the library's FIQ
+    // handler. Replace just that word with a branch to ours, leaving the
+    // constants the other vectors load from untouched.
+    unsigned int offset = ((unsigned int) keyboard_fiq_handler - ((unsigned int) FIQ_VECTOR + 8)) >> 2;
+    *FIQ_VECTOR = 0xEA000000 | (offset & 0xFFFFFF);
+    // GPIO events go to FIQ, not IRQ, only one source can be routed there
+    *FIQ_CONTROL = FIQ_ENABLE | INTERRUPTS_GPIO3;
+    using_fiq = true;
+    keyboard_fiq_enable();
+#else
+    ps2_decoder_init(&decoder);
     interrupts_attach_handler(interrupt_handler);
     interrupts_enable_source(INTERRUPTS_GPIO3);
     interrupts_global_enable();
+#endif
 }
 
 void keyboard_init(void) 
@@ -79,51 +448,112 @@ void keyboard_init(void)
     gpio_set_input(DATA); 
     gpio_set_pullup(DATA); 
 
-    setup_interrupts();
+    build_tables();
+
+    // ring buffer must exist before the first edge arrives
     rb = rb_new();
+    rb_set_name(rb, "keyboard");
+    setup_interrupts();
+}
+
+// helper function to sleep until the next interrupt unless rb already has
+// a scancode. If `timed`, system timer compare 1 is armed to raise an
+// interrupt at `deadline` so the sleep can't outlast it.
+static void wait_for_scancode(bool timed, unsigned int deadline)
+{
+    unsigned int cpsr;
+    __asm__ volatile ("mrs %0, cpsr" : "=r" (cpsr));
+    __asm__ volatile ("msr cpsr_c, %0" : : "r" (cpsr | CPSR_IRQ_FIQ_MASK) : "memory");
+
+    if (timed) {
+        *SYSTIMER_C1 = deadline;
+        *SYSTIMER_CS = SYSTIMER_M1;
+        *IRQ_ENABLE_1 = SYSTIMER_M1;
+    }
+    // Checked with interrupts masked: one that arrives after this still
+    // wakes the WFI, it is just handled once the mask is restored below
+    if (rb_empty(rb) && !(timed && (int) (timer_get_ticks() - deadline) >= 0)) {
+        __asm__ volatile ("mcr p15, 0, %0, c7, c0, 4" : : "r" (0) : "memory");
+    }
+    // the match is cleared here so it never reaches the IRQ handler
+    if (timed) {
+        *IRQ_DISABLE_1 = SYSTIMER_M1;
+        *SYSTIMER_CS = SYSTIMER_M1;
+    }
+
+    __asm__ volatile ("msr cpsr_c, %0" : : "r" (cpsr) : "memory");
 }
 
 unsigned char keyboard_read_scancode(void) 
 {
-    // wait for rb to contain a scancode
-    while (rb_empty(rb)) {}
+    // sleep until rb contains a scancode
     int scancode;
-    rb_dequeue(rb, &scancode);
-    return (unsigned char) scancode;
+    while (!rb_dequeue(rb, &scancode)) {
+        wait_for_scancode(false, 0);
+    }
+    return (unsigned char) scancode;  // drops the stamp
 }
 
-int keyboard_read_sequence(unsigned char seq[])
+// helper function to add scancodes to partial_seq until it holds a whole
+// sequence. Waits for them forever if `forever`, otherwise for up to
+// `timeout_us`, which must be under 2^31. Returns false if the sequence
+// is still incomplete.
+static bool fill_sequence(bool forever, unsigned int timeout_us)
 {
-    int bytes_written = 0;
-    unsigned char scancode = keyboard_read_scancode();
-    // check for extended code
-    if (scancode == PS2_CODE_EXTEND) {
-        seq[bytes_written] = scancode;
-        bytes_written++;
-        scancode = keyboard_read_scancode();
+    unsigned int deadline = timer_get_ticks() + timeout_us;
+    while (partial_len == 0 ||
+           (partial_len < sizeof(partial_seq) &&
+            (partial_seq[partial_len - 1] == PS2_CODE_EXTEND ||
+             partial_seq[partial_len - 1] == PS2_CODE_RELEASE))) {
+        int scancode;
+        while (!rb_dequeue(rb, &scancode)) {
+            if (!forever && (timeout_us == 0 || (int) (timer_get_ticks() - deadline) >= 0)) {
+                return false;
+            }
+            wait_for_scancode(!forever, deadline);
+        }
+        partial_seq[partial_len++] = scancode;
+        event_stamp = (unsigned int) scancode >> STAMP_SHIFT;
     }
-    // check for break code
-    if (scancode == PS2_CODE_RELEASE) {
-        seq[bytes_written] = scancode;
-        bytes_written++;
-        scancode = keyboard_read_scancode();
+    return true;
+}
+
+// helper function to hand over the sequence in partial_seq
+static int take_sequence(unsigned char seq[])
+{
+    int seq_len = partial_len;
+    memcpy(seq, partial_seq, seq_len);
+    partial_len = 0;
+
+    consumed_ticks = timer_get_ticks();
+    record_latency(&queue_latency, (consumed_ticks - event_stamp) & STAMP_MASK);
+    return seq_len;
+}
+
+int keyboard_read_sequence(unsigned char seq[])
+{
+    // about to block anyway, so the time to talk to the keyboard
+    if (leds_pending) {
+        leds_pending = false;
+        keyboard_set_leds(modifiers);
     }
-    seq[bytes_written] = scancode;
-    bytes_written++;
-    return bytes_written;
+    fill_sequence(true, 0);
+    return take_sequence(seq);
 }
 
-key_event_t keyboard_read_event(void) 
+// helper function to turn a whole sequence into an event
+// and update the modifiers it changes
+static key_event_t decode_event(const unsigned char seq[], int seq_len)
 {
     key_event_t event;
-    unsigned char seq[3];
 
-    int seq_len = keyboard_read_sequence(seq);
     memcpy(event.seq, seq, seq_len);
     event.seq_len = seq_len;
 
+    int extended = (seq[0] == PS2_CODE_EXTEND);
     unsigned char key_code = seq[seq_len - 1];
-    event.key = ps2_keys[key_code];
+    if (key_code >= NUM_SCANCODES) key_code = 0;
+    event.key = key_table[extended][key_code];
 
     // check if key has been pressed or released
     if (seq_len > 1 && seq[seq_len - 2] == PS2_CODE_RELEASE) {
@@ -132,115 +562,62 @@ key_event_t keyboard_read_event(void)
         event.action = KEYBOARD_ACTION_DOWN;
     }
 
-    if (event.key.ch == PS2_KEY_SCROLL_LOCK) {
-        if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers ^= KEYBOARD_MOD_SCROLL_LOCK;
-        }
-    }
-
-    if (event.key.ch == PS2_KEY_NUM_LOCK) {
+    // lock keys flip on press and show on the LEDs, the others are held
+    unsigned int bit = modifier_table[extended][key_code];
+    if (bit & LOCK_MODIFIERS) {
         if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers ^= KEYBOARD_MOD_NUM_LOCK;
+            modifiers ^= bit;
+            leds_pending = true;
         }
+    } else if (event.action == KEYBOARD_ACTION_DOWN) {
+        modifiers |= bit;
+    } else {
+        modifiers &= ~bit;
     }
 
-    if (event.key.ch == PS2_KEY_CAPS_LOCK) {
-        if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers ^= KEYBOARD_MOD_CAPS_LOCK;
-        }
-    }
+    event.modifiers = modifiers;
 
-    if (event.key.ch == PS2_KEY_SHIFT) {
-        if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers |= KEYBOARD_MOD_SHIFT;
-        } else {
-            modifiers &= ~KEYBOARD_MOD_SHIFT;
-        }   
-    }
+    return event;
+}
 
-    if (event.key.ch == PS2_KEY_ALT) {
-        if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers |= KEYBOARD_MOD_ALT;
-        } else {
-            modifiers &= ~KEYBOARD_MOD_ALT;
-        } 
-    }
+key_event_t keyboard_read_event(void) 
+{
+    unsigned char seq[3];
+    int seq_len = keyboard_read_sequence(seq);
+    return decode_event(seq, seq_len);
+}
 
-    if (event.key.ch == PS2_KEY_CTRL) {
-        if (event.action == KEYBOARD_ACTION_DOWN) {
-            modifiers |= KEYBOARD_MOD_CTRL;
-        } else {
-            modifiers &= ~KEYBOARD_MOD_CTRL;
-        } 
-    }
+bool keyboard_poll_event(key_event_t *event)
+{
+    return keyboard_read_event_timeout(event, 0);
+}
 
-    event.modifiers = modifiers;
+bool keyboard_read_event_timeout(key_event_t *event, unsigned int ms)
+{
+    if (ms > KEYBOARD_MAX_TIMEOUT_MS) ms = KEYBOARD_MAX_TIMEOUT_MS;
+    if (!fill_sequence(false, ms * 1000)) return false;
 
-    return event;
+    unsigned char seq[3];
+    int seq_len = take_sequence(seq);
+    *event = decode_event(seq, seq_len);
+    return true;
 }
 
 
 unsigned char keyboard_read_next(void) 
 {
-    unsigned char char_read = '!';
     while (true) {
-        int has_shift = 0;
-        int has_caps_lock = 0;
         key_event_t event = keyboard_read_event();
 
         // do nothing on a key release
         if (event.action == KEYBOARD_ACTION_UP) continue;
 
-        // don't return modifier codes or non-characters
-        if (event.key.ch == PS2_KEY_SHIFT ||
-            event.key.ch == PS2_KEY_SCROLL_LOCK ||
-            event.key.ch == PS2_KEY_NUM_LOCK ||
-            event.key.ch == PS2_KEY_CAPS_LOCK ||
-            event.key.ch == PS2_KEY_ALT ||
-            event.key.ch == PS2_KEY_CTRL) continue;
-
-        if ((event.modifiers >> 2 & 1) == 1) {
-            has_caps_lock = 1;
-        }
-        if ((event.modifiers >> 3 & 1) == 1) {
-            has_shift = 1;
-        }
-
-        // either shifted or caps locked character
-        if ((has_shift || has_caps_lock) && !(has_shift && has_caps_lock)) {
-            // caps lock shouldn't change non-letters
-            if (has_caps_lock && !has_shift && 
-                (event.key.ch < 'a' || event.key.ch > 'z')) {
-                char_read = event.key.ch;
-                break;
-            }
-            // edge case check if only one value
-            // associated with key
-            if (event.key.other_ch == 0) {
-                char_read = event.key.ch;
-                break;
-            }
-            char_read = event.key.other_ch;
-            break;
-        } else {
-            // caps lock shouldn't change non-letters
-            if (has_caps_lock && has_shift && 
-                (event.key.ch < 'a' || event.key.ch > 'z')) {
-                // edge case check if only one value
-                // associated with key
-                if (event.key.other_ch == 0) {
-                    char_read = event.key.ch;
-                    break;
-                }
-                char_read = event.key.other_ch;
-                break;
-            }
-            // no caps lock or shift
-            char_read = event.key.ch;
-            break;
-        }
+        int extended = (event.seq[0] == PS2_CODE_EXTEND);
+        unsigned char key_code = event.seq[event.seq_len - 1];
+        if (key_code >= NUM_SCANCODES) continue;
 
+        // modifier codes and non-characters are 0 in the table
+        unsigned char ch = char_table[extended][CHAR_PLANE(event.modifiers)][key_code];
+        if (ch) return ch;
     }
-
-    return char_read;
 }
@@ -0,0 +1,127 @@
+// FIQ handler for the PS/2 keyboard clock line, see keyboard.c.
+//
+// One FIQ arrives per falling clock edge, 11 per scancode. The bit
+// state machine lives in the banked FIQ registers so that an edge
+// costs a handful of instructions and no memory traffic for state:
+//
+//   r8  GPIO base address
+//   r9  bit count within the frame (0 waits for the start bit)
+//   r10 scancode accumulated so far
+//   r11 parity of the data bits so far
+//
+// This is the state machine of ps2decoder.c, keep the two in step.
+// keyboard_fiq_init() loads these before the FIQ is enabled. A full
+// frame is handed to keyboard_frame_done(scancode, stop_bit) in C,
+// running on the FIQ stack set up by start.s at 0x4000. Events on
+// other pins of the bank raise the same FIQ and are passed on to
+// keyboard_fiq_other(events).
+
+.equ GPLEV0, 0x34
+.equ GPEDS0, 0x40
+.equ CLK_BIT, (1 << 23)
+.equ DATA_SHIFT, 24
+.equ TIMER_CLO, 0x20003004
+.equ RESYNC_US, 250        // PS2_DECODER_RESYNC_US
+
+.globl keyboard_fiq_init
+keyboard_fiq_init:
+    mrs r1, cpsr
+    msr cpsr_c, #0xD1      // Fast interrupts, IRQ and FIQ masked
+    mov r8, r0
+    mov r9, #0
+    mov r10, #0
+    mov r11, #0
+    msr cpsr_c, r1         // back to the caller's mode
+    bx lr
+
+.globl keyboard_fiq_enable
+keyboard_fiq_enable:
+    mrs r0, cpsr
+    bic r0, r0, #0x40      // clear F to unmask fast interrupts
+    msr cpsr_c, r0
+    bx lr
+
+.globl keyboard_fiq_handler
+keyboard_fiq_handler:
+    push {r0-r3}
+    ldr r0, [r8, #GPEDS0]
+    bics r1, r0, #CLK_BIT
+    beq clock_only
+    push {r0, r1, r12, lr}
+    ldr r2, =keyboard_fiq_other
+    mov lr, pc
+    bx r2
+    pop {r0, r1, r12, lr}
+
+clock_only:
+    tst r0, #CLK_BIT
+    beq done
+    mov r0, #CLK_BIT
+    str r0, [r8, #GPEDS0]  // writing 1 clears the clock event
+
+    // timestamp the edge so keyboard.c can measure latency
+    ldr r0, =TIMER_CLO
+    ldr r0, [r0]
+    ldr r1, =keyboard_edge_times
+
+    // mid-frame, a gap longer than any clock period means edges
+    // were lost, so drop the partial frame and look for a start bit
+    subs r2, r9, #1
+    ldrpl r2, [r1, r2, lsl #2]
+    subpl r2, r0, r2
+    cmppl r2, #RESYNC_US
+    movhi r9, #0
+    movhi r10, #0
+    movhi r11, #0
+
+    cmp r9, #10
+    strls r0, [r1, r9, lsl #2]
+
+    ldr r0, [r8, #GPLEV0]
+    mov r0, r0, lsr #DATA_SHIFT
+    and r0, r0, #1         // r0 = data bit
+
+    cmp r9, #0
+    bne not_start
+    cmp r0, #0             // start bit must be low
+    addeq r9, r9, #1
+    b done
+
+not_start:
+    cmp r9, #9
+    blt data_bit
+    beq parity_bit
+
+    // stop bit, frame is complete
+    mov r1, r0
+    mov r0, r10
+    mov r9, #0
+    mov r10, #0
+    mov r11, #0
+    push {r12, lr}         // C may use both, lr is our return address
+    ldr r2, =keyboard_frame_done
+    mov lr, pc
+    bx r2
+    pop {r12, lr}
+    b done
+
+parity_bit:
+    eor r1, r11, r0
+    tst r1, #1             // odd parity is good, otherwise start over
+    addne r9, r9, #1
+    moveq r9, #0
+    moveq r10, #0
+    moveq r11, #0
+    b done
+
+data_bit:
+    sub r1, r9, #1
+    orr r10, r10, r0, lsl r1
+    eor r11, r11, r0
+    add r9, r9, #1
+
+done:
+    pop {r0-r3}
+    subs pc, lr, #4
+
+.ltorg
@@ -0,0 +1,109 @@
+#ifndef KEYBOARDEXTRA_H
+#define KEYBOARDEXTRA_H
+
+/*
+ * Extensions to the library keyboard module (keyboard.h) implemented
+ * in keyboard.c.
+ */
+
+#include "keyboard.h"
+
+/*
+ * Worst lateness, in microseconds, with which a PS/2 clock edge has been
+ * handled since the last reset. Edges arrive at a steady rate within a
+ * frame, so each frame's lateness is how far its latest edge strays from
+ * that rate compared to its earliest.
+ */
+unsigned int keyboard_get_edge_latency(void);
+void keyboard_reset_edge_latency(void);
+
+/*
+ * Latency histograms of the input path. Bucket 0 counts latencies of
+ * 0 or 1 microseconds and bucket i counts those from 2^i up to
+ * 2^(i+1) - 1. The last bucket also counts everything longer.
+ */
+#define KEYBOARD_LATENCY_BUCKETS 24
+
+typedef struct {
+    unsigned int counts[KEYBOARD_LATENCY_BUCKETS];
+    unsigned int total;
+    unsigned int max;
+} keyboard_latency_t;
+
+/*
+ * Every scancode is stamped with timer_get_ticks() by the interrupt
+ * handler. keyboard_get_event_ticks() gives the low 24 bits of the stamp
+ * of the last scancode in the event most recently read.
+ */
+unsigned int keyboard_get_event_ticks(void);
+
+/*
+ * Time from a sequence's last scancode arriving to it being read as
+ * an event, and from it being read to keyboard_record_echo().
+ */
+const keyboard_latency_t *keyboard_get_queue_latency(void);
+const keyboard_latency_t *keyboard_get_echo_latency(void);
+void keyboard_reset_latency(void);
+
+/*
+ * Call when the event most recently read has been echoed to the screen.
+ */
+void keyboard_record_echo(void);
+
+/*
+ * The keyboard takes GPIO events as FIQ, and every GPIO pin raises that
+ * same interrupt. This registers `fn` to be called, in FIQ mode, when
+ * other pins have events; it must clear the ones it handles. Returns
+ * false if the keyboard isn't using the FIQ, in which case `fn` should
+ * be attached as an ordinary interrupt handler instead.
+ */
+bool keyboard_attach_gpio_handler(void (*fn)(unsigned int pc));
+
+/*
+ * Commands sent to the keyboard, each returns false if the keyboard
+ * didn't acknowledge it. They pause receiving while they run, about a
+ * millisecond per byte sent, so call them from the main program only.
+ */
+
+/*
+ * Turns on the lock LEDs for the KEYBOARD_MOD_SCROLL_LOCK,
+ * KEYBOARD_MOD_NUM_LOCK and KEYBOARD_MOD_CAPS_LOCK bits of `leds`.
+ * Events that toggle a lock update the LEDs themselves, the next time
+ * a blocking read waits for a key, so polling reads never wait on it.
+ */
+bool keyboard_set_leds(unsigned int leds);
+
+/*
+ * Sets how long a key is held before it repeats (250 ms to 1 s) and how
+ * fast it repeats (2 to 30 characters per second), rounded to the
+ * nearest the keyboard supports.
+ */
+bool keyboard_set_typematic(unsigned int delay_ms, unsigned int rate_cps);
+
+/*
+ * Switches the keyboard to scan code set 2 (the default) or 3. In set 3
+ * only modifier keys send break codes and no key sends an extended
+ * prefix, so most key presses are a single scancode. If the keyboard
+ * refuses set 3, it is put back in set 2 and false is returned.
+ */
+bool keyboard_set_scancode_set(int set);
+
+/*
+ * Non-blocking keyboard_read_event(). If a whole key sequence has
+ * arrived, stores its event in `event` and returns true. Otherwise
+ * returns false at once; bytes of a sequence still arriving are kept
+ * for the next call.
+ */
+bool keyboard_poll_event(key_event_t *event);
+
+// longest timeout the 32-bit system timer compare can measure, about 35 minutes
+#define KEYBOARD_MAX_TIMEOUT_MS 2000000
+
+/*
+ * Like keyboard_poll_event(), but sleeps for up to `ms` milliseconds
+ * waiting for a sequence to complete. Uses system timer compare 1.
+ * Timeouts over KEYBOARD_MAX_TIMEOUT_MS are cut down to it.
+ */
+bool keyboard_read_event_timeout(key_event_t *event, unsigned int ms);
+
+#endif
@@ -14,6 +14,7 @@
  */
 
 #include "malloc.h"
+#include "mallocextra.h"
 #include <stddef.h> // for NULL
 #include "strings.h"
 #include "printf.h"
@@ -48,6 +49,9 @@ struct header {
 };
 const unsigned int header_size = sizeof(header);
 
+// running totals since boot, see mallocextra.h
+static malloc_counters_t counters;
+
 void coalesce(header *cur_hdr);
 
 void *malloc(size_t nbytes) 
@@ -94,6 +98,8 @@ void *malloc(size_t nbytes)
         cur_hdr->status = 1;
 
         alloc = (char *) cur_hdr + header_size;
+        counters.allocs++;
+        counters.bytes_allocated += nbytes;
 
         // create a new header for what's
         // left of the free block
@@ -124,6 +130,8 @@ void free(void *ptr)
 
     header *cur_hdr = (header *) ((char *) ptr - header_size);
     cur_hdr->status = 0;
+    counters.frees++;
+    counters.bytes_freed += cur_hdr->payload_size;
 
     // coalesce any following free blocks
     coalesce(cur_hdr);
@@ -155,6 +163,7 @@ void *realloc(void *old_ptr, size_t new_size)
         next_hdr->payload_size = old_size - new_size - header_size;
         next_hdr->status = 0;
         coalesce(next_hdr);
+        counters.bytes_freed += old_size - new_size;
         new_ptr = (char *) cur_hdr + header_size;
         return new_ptr;
     // if the block doesn't have enough space
@@ -174,6 +183,7 @@ void *realloc(void *old_ptr, size_t new_size)
             header *new_hdr = (header *) ((char *) cur_hdr + cur_hdr->payload_size + header_size);
             new_hdr->payload_size = next_hdr->payload_size - (new_size - old_size);
             new_hdr->status = 0;
+            counters.bytes_allocated += new_size - old_size;
             new_ptr = (char *) cur_hdr + header_size;
             return new_ptr;
         }
@@ -187,6 +197,11 @@ void *realloc(void *old_ptr, size_t new_size)
     return new_ptr;
 }
 
+malloc_counters_t malloc_get_counters(void)
+{
+    return counters;
+}
+
 void heap_dump () {
     printf("Starting heap dump:\n");
     header *cur_hdr = (header *) heap_start;
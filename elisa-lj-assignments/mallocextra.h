@@ -0,0 +1,25 @@
+#ifndef MALLOCEXTRA_H
+#define MALLOCEXTRA_H
+
+/*
+ * Extensions to the library malloc module (malloc.h) implemented
+ * in malloc.c.
+ */
+
+#include "malloc.h"
+
+/*
+ * Totals since boot. Sizes are payload bytes after rounding up; a
+ * realloc that resizes in place counts only the bytes it adds or
+ * gives back. Subtract two readings to get the activity between them.
+ */
+typedef struct {
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int bytes_allocated;
+    unsigned int bytes_freed;
+} malloc_counters_t;
+
+malloc_counters_t malloc_get_counters(void);
+
+#endif
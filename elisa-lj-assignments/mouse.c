@@ -2,7 +2,13 @@
 #include "gpioextra.h"
 #include "interrupts.h"
 #include "ringbuffer.h"
+#include "ringbufferextra.h"
+#include "keyboardextra.h"
+#include "ps2decoder.h"
+#include "ps2writer.h"
+#include "timer.h"
 #include "mouse.h"
+#include "mouseextra.h"
 
 #define MOUSE_CLK GPIO_PIN25
 #define MOUSE_DATA GPIO_PIN26
@@ -10,43 +16,212 @@
 #define CMD_RESET 0xFF
 #define CMD_ENABLE_DATA_REPORTING 0xF4
 
+#define RESPONSE_SELF_TEST_PASSED 0xAA
+
+// the mouse finishes its self test within 500 ms of a reset
+#define SELF_TEST_TIMEOUT_US 1000000
+
+// bits of the first byte of a packet
+#define PACKET_LEFT (1 << 0)
+#define PACKET_RIGHT (1 << 1)
+#define PACKET_MIDDLE (1 << 2)
+#define PACKET_ALWAYS_ONE (1 << 3)
+#define PACKET_X_SIGN (1 << 4)
+#define PACKET_Y_SIGN (1 << 5)
+#define PACKET_X_OVERFLOW (1 << 6)
+#define PACKET_Y_OVERFLOW (1 << 7)
+#define PACKET_BUTTONS (PACKET_LEFT | PACKET_RIGHT | PACKET_MIDDLE)
+
+// Each ring entry is a whole 3-byte packet, first byte lowest
 static rb_t *rb;
 
-static void mouse_write(unsigned char data);
+// packet being assembled by the handler
+static ps2_decoder_t decoder;
+static unsigned int packet = 0;
+static int packet_len = 0;
+static unsigned int last_byte_ticks = 0;
+
+// A byte takes up to 2.2 ms at the slowest 5 kHz PS/2 clock, and the
+// bytes of a packet follow each other closely. Bytes further apart
+// than this, end to end, can't be from the same packet. At the
+// default 100 packets a second a packet cut short by a lost byte is
+// always caught; at higher rates it may not be, but that costs one
+// bad packet, never a valid one.
+#define PACKET_GAP_US 4500
+
+// packets taken off the ring in one batch but not yet read
+#define BATCH_SIZE 16
+static int batch[BATCH_SIZE];
+static int batch_start = 0;
+static int batch_len = 0;
+
+// packet bytes not yet returned by mouse_read_scancode()
+static unsigned int scancodes = 0;
+static int num_scancodes = 0;
+
+// buttons held in the last packet read
+static unsigned int buttons = 0;
+
+static void mouse_handler(unsigned int pc);
+
+// helper function to read a byte the mouse sends after a reset
+static bool read_response(unsigned char *byte)
+{
+  return ps2_read_polled(MOUSE_CLK, MOUSE_DATA, byte, SELF_TEST_TIMEOUT_US);
+}
 
 bool mouse_init(void)
 {
   rb = rb_new();
+  rb_set_name(rb, "mouse");
 
   gpio_set_function(MOUSE_CLK, GPIO_FUNC_INPUT);
   gpio_set_pullup(MOUSE_CLK);
   gpio_set_function(MOUSE_DATA, GPIO_FUNC_INPUT);
   gpio_set_pullup(MOUSE_DATA);
 
-  // FIXME: Initialize mouse.
+  // a reset is acknowledged, then the self test passes, then the
+  // mouse sends its device id
+  unsigned char response;
+  if (!ps2_command(MOUSE_CLK, MOUSE_DATA, CMD_RESET, 0) ||
+      !read_response(&response) || response != RESPONSE_SELF_TEST_PASSED ||
+      !read_response(&response)) {
+    return false;
+  }
+  if (!ps2_command(MOUSE_CLK, MOUSE_DATA, CMD_ENABLE_DATA_REPORTING, 0)) return false;
+
+  ps2_decoder_init(&decoder);
+  gpio_enable_event_detection(MOUSE_CLK, GPIO_DETECT_FALLING_EDGE);
+  // the keyboard may own the GPIO interrupt as FIQ, then it passes ours on
+  if (!keyboard_attach_gpio_handler(mouse_handler)) {
+    interrupts_attach_handler(mouse_handler);
+    interrupts_enable_source(INTERRUPTS_GPIO3);
+    interrupts_global_enable();
+  }
+  return true;
 }
 
-mouse_event_t mouse_read_event(void)
+// helper function to look at the next packet without taking it
+static bool peek_packet(unsigned int *p_packet)
+{
+  if (batch_len == 0) {
+    batch_start = 0;
+    batch_len = rb_dequeue_n(rb, batch, BATCH_SIZE);
+    if (batch_len == 0) return false;
+  }
+  *p_packet = batch[batch_start];
+  return true;
+}
+
+// helper function to take the packet peek_packet() returned
+static void take_packet(void)
+{
+  batch_start++;
+  batch_len--;
+}
+
+// helper function to turn a packet into an event
+static mouse_event_t decode_packet(unsigned int packet)
 {
   mouse_event_t evt;
+  unsigned int flags = packet & 0xFF;
 
-  // FIXME: Read scancode(s) and fill in evt.
+  // 9-bit two's complement, the sign bits are in the first byte
+  evt.dx = ((packet >> 8) & 0xFF) - ((flags & PACKET_X_SIGN) ? 0x100 : 0);
+  evt.dy = ((packet >> 16) & 0xFF) - ((flags & PACKET_Y_SIGN) ? 0x100 : 0);
+  evt.x_overflow = (flags & PACKET_X_OVERFLOW) != 0;
+  evt.y_overflow = (flags & PACKET_Y_OVERFLOW) != 0;
+  evt.left = (flags & PACKET_LEFT) != 0;
+  evt.right = (flags & PACKET_RIGHT) != 0;
+  evt.middle = (flags & PACKET_MIDDLE) != 0;
 
+  unsigned int pressed = flags & PACKET_BUTTONS;
+  if (pressed & ~buttons) {
+    evt.action = MOUSE_BUTTON_PRESS;
+  } else if (buttons & ~pressed) {
+    evt.action = MOUSE_BUTTON_RELEASE;
+  } else if (pressed) {
+    evt.action = MOUSE_DRAG;
+  } else {
+    evt.action = MOUSE_MOVE;
+  }
+  buttons = pressed;
   return evt;
 }
 
-int mouse_read_scancode(void)
+mouse_event_t mouse_read_event(void)
 {
-  // FIXME: Read from ring buffer.
-  return 0;
+  unsigned int packet;
+  while (!peek_packet(&packet)) {}
+  take_packet();
+  return decode_packet(packet);
 }
 
-static void mouse_write(unsigned char data)
+bool mouse_read_coalesced(mouse_event_t *evt)
 {
-  // FIXME: Send host->mouse packet.
+  unsigned int packet;
+  if (!peek_packet(&packet)) return false;
+  take_packet();
+  *evt = decode_packet(packet);
+
+  // a button change ends the run, so no press or release is lost
+  while (peek_packet(&packet) && (packet & PACKET_BUTTONS) == buttons) {
+    take_packet();
+    mouse_event_t next = decode_packet(packet);
+    evt->dx += next.dx;
+    evt->dy += next.dy;
+    evt->x_overflow |= next.x_overflow;
+    evt->y_overflow |= next.y_overflow;
+  }
+  return true;
+}
+
+int mouse_read_scancode(void)
+{
+  if (num_scancodes == 0) {
+    while (!peek_packet(&scancodes)) {}
+    take_packet();
+    num_scancodes = 3;
+  }
+  int scancode = scancodes & 0xFF;
+  scancodes >>= 8;
+  num_scancodes--;
+  return scancode;
 }
 
 static void mouse_handler(unsigned int pc)
 {
-  // FIXME: Handle event on mouse clock line
+  if (!gpio_check_and_clear_event(MOUSE_CLK)) return;
+
+  unsigned int errors = decoder.parity_errors + decoder.resyncs;
+  unsigned int ticks = timer_get_ticks();
+  unsigned char byte;
+  ps2_decoder_result_t result = ps2_decoder_edge(&decoder, gpio_read(MOUSE_DATA), ticks, &byte);
+
+  // a bad, dropped or cut off frame leaves the packet short, start over
+  if (result == PS2_DECODER_BAD_STOP || decoder.parity_errors + decoder.resyncs != errors) {
+    packet = 0;
+    packet_len = 0;
+    return;
+  }
+  if (result != PS2_DECODER_FRAME) return;
+
+  // a whole byte can go missing without an error, but the bytes of a
+  // packet come close together, so a long wait means a new packet
+  if (packet_len > 0 && ticks - last_byte_ticks > PACKET_GAP_US) {
+    packet = 0;
+    packet_len = 0;
+  }
+  last_byte_ticks = ticks;
+
+  // the first byte always has bit 3 set, use it to find packet starts
+  if (packet_len == 0 && !(byte & PACKET_ALWAYS_ONE)) return;
+
+  packet |= byte << (8 * packet_len);
+  packet_len++;
+  if (packet_len == 3) {
+    rb_enqueue(rb, packet);
+    packet = 0;
+    packet_len = 0;
+  }
 }
@@ -0,0 +1,21 @@
+#ifndef MOUSEEXTRA_H
+#define MOUSEEXTRA_H
+
+/*
+ * Extensions to the library mouse module (mouse.h) implemented
+ * in mouse.c.
+ */
+
+#include "mouse.h"
+
+/*
+ * Non-blocking read that folds a run of queued packets into one event,
+ * so a slow loop sees where the mouse is now instead of replaying every
+ * step it took. dx and dy are the sums over the run and the overflow
+ * flags are set if any packet overflowed. A run ends before any packet
+ * that presses or releases a button, so clicks are never merged away.
+ * Returns false if no packets are queued.
+ */
+bool mouse_read_coalesced(mouse_event_t *evt);
+
+#endif
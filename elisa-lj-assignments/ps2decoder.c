@@ -0,0 +1,62 @@
+#include "ps2decoder.h"
+
+// helper function to throw away the frame read so far
+static void restart(ps2_decoder_t *dec)
+{
+    dec->cnt = 0;
+    dec->scancode = 0;
+    dec->parity = 0;
+}
+
+void ps2_decoder_init(ps2_decoder_t *dec)
+{
+    restart(dec);
+    dec->last_ticks = 0;
+    dec->frames = 0;
+    dec->parity_errors = 0;
+    dec->stop_errors = 0;
+    dec->resyncs = 0;
+}
+
+ps2_decoder_result_t ps2_decoder_edge(ps2_decoder_t *dec, unsigned int data,
+                                      unsigned int ticks, unsigned char *scancode)
+{
+    unsigned int gap = ticks - dec->last_ticks;
+    dec->last_ticks = ticks;
+    if (dec->cnt > 0 && gap > PS2_DECODER_RESYNC_US) {
+        dec->resyncs++;
+        restart(dec);
+    }
+
+    // checking for start bit
+    if (dec->cnt == 0) {
+        if (data == 0) dec->cnt++;
+        return PS2_DECODER_BUSY;
+    }
+    // check parity, if even, start over
+    if (dec->cnt == 9) {
+        if (((dec->parity ^ data) & 1) == 0) {
+            dec->parity_errors++;
+            restart(dec);
+        } else {
+            dec->cnt++;
+        }
+        return PS2_DECODER_BUSY;
+    }
+    // stop bit, full scancode has been read
+    if (dec->cnt == 10) {
+        *scancode = dec->scancode;
+        restart(dec);
+        if (data != 1) {
+            dec->stop_errors++;
+            return PS2_DECODER_BAD_STOP;
+        }
+        dec->frames++;
+        return PS2_DECODER_FRAME;
+    }
+    // otherwise, read data
+    dec->scancode |= data << (dec->cnt - 1);
+    dec->parity ^= data;
+    dec->cnt++;
+    return PS2_DECODER_BUSY;
+}
@@ -0,0 +1,53 @@
+#ifndef PS2DECODER_H
+#define PS2DECODER_H
+
+/*
+ * Bit-level decoder for PS/2 device-to-host frames, fed one falling
+ * clock edge at a time. A frame is 11 bits: a low start bit, 8 data
+ * bits least significant first, an odd parity bit and a high stop bit.
+ *
+ * The keyboard's IRQ handler uses this module directly and the FIQ
+ * handler in keyboard_fiq.s is a register-only copy of the same state
+ * machine, so the two must be changed together. The decoder only needs
+ * the data line level and a time for each edge, which lets the host
+ * simulator in tests/test_ps2decoder.c drive it.
+ */
+
+#include <stdbool.h>
+
+// The device clocks at 10-16.7 kHz, so a gap this long between edges
+// can only mean edges were lost: the partial frame is dropped and the
+// edge is taken as a possible start bit
+#define PS2_DECODER_RESYNC_US 250
+
+typedef enum {
+    PS2_DECODER_BUSY,      // frame not finished yet
+    PS2_DECODER_FRAME,     // scancode is valid
+    PS2_DECODER_BAD_STOP,  // frame finished with a low stop bit
+} ps2_decoder_result_t;
+
+typedef struct {
+    int cnt;                 // bits of the frame read so far
+    unsigned char scancode;  // data bits read so far
+    unsigned int parity;     // xor of the data bits read so far
+    unsigned int last_ticks; // time of the previous edge
+
+    // counts of each outcome since ps2_decoder_init()
+    unsigned int frames;
+    unsigned int parity_errors;
+    unsigned int stop_errors;
+    unsigned int resyncs;
+} ps2_decoder_t;
+
+void ps2_decoder_init(ps2_decoder_t *dec);
+
+/*
+ * Feeds the decoder one falling clock edge, with the level of the data
+ * line and the time in microseconds. When the edge completes a frame,
+ * stores its data bits in `scancode` and returns PS2_DECODER_FRAME or
+ * PS2_DECODER_BAD_STOP. Frames failing parity are dropped silently.
+ */
+ps2_decoder_result_t ps2_decoder_edge(ps2_decoder_t *dec, unsigned int data,
+                                      unsigned int ticks, unsigned char *scancode);
+
+#endif
@@ -0,0 +1,87 @@
+#include "ps2writer.h"
+#include "ps2decoder.h"
+#include "gpio.h"
+#include "timer.h"
+
+// The device must start clocking within 15 ms of a request to send
+// and answer a command within 20 ms; some take longer after a reset
+#define CLOCK_TIMEOUT_US 15000
+#define RESPONSE_TIMEOUT_US 25000
+#define MAX_RESENDS 3
+
+// helper function to wait for the clock line to reach `level`
+static bool wait_for_clock(unsigned int clk, unsigned int level, unsigned int timeout_us)
+{
+    unsigned int start = timer_get_ticks();
+    while (gpio_read(clk) != level) {
+        if (timer_get_ticks() - start > timeout_us) return false;
+    }
+    return true;
+}
+
+bool ps2_write(unsigned int clk, unsigned int data, unsigned char byte)
+{
+    // request to send: hold the clock low for at least 100 us, pull data
+    // low and let the clock go so the device clocks the byte in
+    gpio_write(clk, 0);
+    gpio_set_output(clk);
+    timer_delay_us(200);
+    gpio_write(data, 0);
+    gpio_set_output(data);
+    gpio_set_input(clk);
+
+    // data bits least significant first, odd parity, then the stop bit
+    // by letting go of data. Each bit is set while the clock is low.
+    unsigned int parity = 1;
+    for (int i = 0; i < 10; i++) {
+        if (!wait_for_clock(clk, 0, CLOCK_TIMEOUT_US)) break;
+        if (i < 8) {
+            unsigned int bit = (byte >> i) & 1;
+            gpio_write(data, bit);
+            parity ^= bit;
+        } else if (i == 8) {
+            gpio_write(data, parity);
+        } else {
+            gpio_set_input(data);
+        }
+        if (!wait_for_clock(clk, 1, CLOCK_TIMEOUT_US)) break;
+    }
+    gpio_set_input(data);
+
+    // the device acknowledges by holding data low for one more clock
+    if (!wait_for_clock(clk, 0, CLOCK_TIMEOUT_US)) return false;
+    bool acked = (gpio_read(data) == 0);
+    wait_for_clock(clk, 1, CLOCK_TIMEOUT_US);
+    return acked;
+}
+
+bool ps2_read_polled(unsigned int clk, unsigned int data, unsigned char *byte,
+                     unsigned int timeout_us)
+{
+    ps2_decoder_t decoder;
+    ps2_decoder_init(&decoder);
+    unsigned int start = timer_get_ticks();
+    while (timer_get_ticks() - start < timeout_us) {
+        if (!wait_for_clock(clk, 1, timeout_us) || !wait_for_clock(clk, 0, timeout_us)) break;
+        if (ps2_decoder_edge(&decoder, gpio_read(data), timer_get_ticks(), byte) ==
+            PS2_DECODER_FRAME) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ps2_command(unsigned int clk, unsigned int data, unsigned char byte, ps2_byte_fn_t other)
+{
+    for (int attempt = 0; attempt <= MAX_RESENDS; attempt++) {
+        if (!ps2_write(clk, data, byte)) continue;
+
+        unsigned char response;
+        while (ps2_read_polled(clk, data, &response, RESPONSE_TIMEOUT_US)) {
+            if (response == PS2_RESPONSE_ACK) return true;
+            if (response == PS2_RESPONSE_RESEND) break;
+            if (other) other(response);
+        }
+    }
+    return false;
+}
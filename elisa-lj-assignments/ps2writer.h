@@ -0,0 +1,40 @@
+#ifndef PS2WRITER_H
+#define PS2WRITER_H
+
+/*
+ * Host-to-device writes on a PS/2 port, bit-banged on its clock and
+ * data pins by polling. Used by the keyboard and mouse drivers to send
+ * commands. The caller must keep its interrupt handler from seeing the
+ * clock edges of the exchange, e.g. by disabling event detection on the
+ * clock pin, since the device clocks both directions.
+ */
+
+#include <stdbool.h>
+
+#define PS2_RESPONSE_ACK 0xFA
+#define PS2_RESPONSE_RESEND 0xFE
+
+/*
+ * Sends `byte`: inhibits the clock, requests to send, clocks out the
+ * data and parity bits as the device drives the clock, and checks the
+ * device's acknowledge bit. Returns false on a timeout or no acknowledge.
+ */
+bool ps2_write(unsigned int clk, unsigned int data, unsigned char byte);
+
+/*
+ * Reads one byte the device sends within `timeout_us` by polling.
+ */
+bool ps2_read_polled(unsigned int clk, unsigned int data, unsigned char *byte,
+                     unsigned int timeout_us);
+
+typedef void (*ps2_byte_fn_t)(unsigned char byte);
+
+/*
+ * Writes `byte` and waits for the device to answer PS2_RESPONSE_ACK,
+ * writing it again if the device asks for a resend. Other bytes the
+ * device sends in the meantime, such as keystrokes it had queued, are
+ * passed to `other`, or dropped if it is null.
+ */
+bool ps2_command(unsigned int clk, unsigned int data, unsigned char byte, ps2_byte_fn_t other);
+
+#endif
@@ -0,0 +1,119 @@
+#include "ringbuffer.h"
+#include "ringbufferextra.h"
+#include "malloc.h"
+
+// Must be a power of two, so indices wrap with a mask instead of %
+#define RB_CAPACITY 512
+#define RB_MASK (RB_CAPACITY - 1)
+
+#if (RB_CAPACITY & RB_MASK) != 0
+#error "RB_CAPACITY must be a power of two"
+#endif
+
+// The producer and consumer are usually an interrupt handler and the
+// main program. Each index is written by only one side, and a barrier
+// orders the entry against the index that publishes or releases it.
+#define memory_barrier() __asm__ volatile ("mcr p15, 0, %0, c7, c10, 5" : : "r" (0) : "memory")
+
+// head and tail count up forever and are masked on use, so
+// head - tail is the number of entries even after they wrap
+struct ringbuffer {
+    unsigned int head;        // written only by the producer
+    unsigned int tail;        // written only by the consumer
+    unsigned int high_water;  // written only by the producer
+    unsigned int drops;       // written only by the producer
+    const char *name;
+    int entries[RB_CAPACITY];
+};
+
+// every ring buffer made, so their stats can be listed
+#define MAX_RINGBUFFERS 8
+static rb_t *all_rbs[MAX_RINGBUFFERS];
+static int num_rbs = 0;
+
+rb_t *rb_new(void)
+{
+    rb_t *rb = malloc(sizeof(struct ringbuffer));
+    if (!rb) return 0;
+
+    rb->head = 0;
+    rb->tail = 0;
+    rb->high_water = 0;
+    rb->drops = 0;
+    rb->name = "?";
+    if (num_rbs < MAX_RINGBUFFERS) {
+        all_rbs[num_rbs++] = rb;
+    }
+    return rb;
+}
+
+bool rb_empty(rb_t *rb)
+{
+    return rb->head == rb->tail;
+}
+
+bool rb_full(rb_t *rb)
+{
+    return rb->head - rb->tail == RB_CAPACITY;
+}
+
+bool rb_enqueue(rb_t *rb, int elem)
+{
+    unsigned int head = rb->head;
+    unsigned int count = head - rb->tail;
+    if (count == RB_CAPACITY) {
+        rb->drops++;
+        return false;
+    }
+
+    rb->entries[head & RB_MASK] = elem;
+    // entry must be written before the consumer can see it
+    memory_barrier();
+    rb->head = head + 1;
+
+    if (count + 1 > rb->high_water) {
+        rb->high_water = count + 1;
+    }
+    return true;
+}
+
+bool rb_dequeue(rb_t *rb, int *p_elem)
+{
+    return rb_dequeue_n(rb, p_elem, 1) == 1;
+}
+
+int rb_dequeue_n(rb_t *rb, int elems[], int max)
+{
+    unsigned int tail = rb->tail;
+    unsigned int count = rb->head - tail;
+    if (count > max) count = max;
+    if (count == 0) return 0;
+
+    // entries are read only after seeing the head that published them
+    memory_barrier();
+    for (int i = 0; i < count; i++) {
+        elems[i] = rb->entries[(tail + i) & RB_MASK];
+    }
+    // and finished with before the producer may reuse their slots
+    memory_barrier();
+    rb->tail = tail + count;
+    return count;
+}
+
+void rb_set_name(rb_t *rb, const char *name)
+{
+    rb->name = name;
+}
+
+bool rb_get_stats(int i, rb_stats_t *stats)
+{
+    if (i < 0 || i >= num_rbs) return false;
+
+    rb_t *rb = all_rbs[i];
+    stats->name = rb->name;
+    stats->capacity = RB_CAPACITY;
+    stats->count = rb->head - rb->tail;
+    stats->high_water = rb->high_water;
+    stats->drops = rb->drops;
+    return true;
+}
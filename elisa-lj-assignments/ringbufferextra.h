@@ -0,0 +1,40 @@
+#ifndef RINGBUFFEREXTRA_H
+#define RINGBUFFEREXTRA_H
+
+/*
+ * Extensions to the library ringbuffer module (ringbuffer.h)
+ * implemented in ringbuffer.c.
+ *
+ * Each ring buffer is safe for one producer (usually an interrupt
+ * handler) and one consumer (usually the main program) without
+ * disabling interrupts.
+ */
+
+#include "ringbuffer.h"
+
+typedef struct {
+    const char *name;
+    unsigned int capacity;    // entries the ring can hold
+    unsigned int count;       // entries currently queued
+    unsigned int high_water;  // most entries ever queued at once
+    unsigned int drops;       // enqueues refused because the ring was full
+} rb_stats_t;
+
+/*
+ * Dequeues up to `max` entries into `elems` with a single update of
+ * the ring's tail. Returns the number of entries dequeued.
+ */
+int rb_dequeue_n(rb_t *rb, int elems[], int max);
+
+/*
+ * Names a ring buffer for rb_get_stats(), e.g. "keyboard".
+ */
+void rb_set_name(rb_t *rb, const char *name);
+
+/*
+ * Fills in `stats` for the `i`th ring buffer created by rb_new().
+ * Returns false if there are not that many.
+ */
+bool rb_get_stats(int i, rb_stats_t *stats);
+
+#endif
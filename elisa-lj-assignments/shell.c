@@ -2,18 +2,47 @@
 #include "shell_commands.h"
 #include "uart.h"
 #include "keyboard.h"
-#include "malloc.h"
+#include "keyboardextra.h"
+#include "console.h"
+#include "consoleextra.h"
 #include "strings.h"
+#include "mallocextra.h"
+#include "timer.h"
 #include "pi.h"
 #include "printf.h"
+#include "ringbufferextra.h"
+#include "bench.h"
+#include <stdarg.h>
 
 #define LINE_LEN 80
 
 static int (*shell_printf)(const char * format, ...);
 
-static char *strndup(const char *src, int n);
+// Commands are found through a perfect hash of their names built by
+// shell_init(): a seed is searched for under which no two names share a
+// slot, so a lookup is one hash and one strcmp. Slots hold index + 1.
+#define MIN_HASH_SLOTS 32
+#define MAX_HASH_SLOTS 1024
+#define MAX_SEED_TRIES 1000
+static unsigned short hash_table[MAX_HASH_SLOTS];
+static unsigned int hash_slots = 0;
+static unsigned int hash_seed = 0;
+
 static int isspace(char ch);
-static int tokenize(const char *line, char *tokens[],  int max);
+static int tokenize(char *line, char *tokens[],  int max);
+static const command_t *find_command(const char *name);
+static int cmd_rbstat(int argc, const char *argv[]);
+static int cmd_latency(int argc, const char *argv[]);
+static int cmd_bench(int argc, const char *argv[]);
+static int cmd_time(int argc, const char *argv[]);
+static int cmd_repeat(int argc, const char *argv[]);
+static int cmd_dump(int argc, const char *argv[]);
+static int cmd_fill(int argc, const char *argv[]);
+static int cmd_copy(int argc, const char *argv[]);
+static int cmd_cmp(int argc, const char *argv[]);
+static int cmd_crc(int argc, const char *argv[]);
+static int cmd_run(int argc, const char *argv[]);
+static int run_command(int argc, const char *argv[]);
 
 static const command_t commands[] = {
     {"help", "<cmd> prints a list of commands or description of cmd", cmd_help},
@@ -21,6 +50,17 @@ static const command_t commands[] = {
     {"reboot", "reboot the Raspberry Pi back to the bootloader", cmd_reboot},
     {"peek", "[address] print contents of memory at address", cmd_peek},
     {"poke", "[address] [value] store value at address", cmd_poke},
+    {"rbstat", "print usage and overflow counts of the ring buffers", cmd_rbstat},
+    {"latency", "<reset> print or reset keystroke queue and echo latency", cmd_latency},
+    {"bench", "<name|all> [samples] list or run micro-benchmarks, timed in us per op", cmd_bench},
+    {"time", "[cmd ...] run cmd and print its time and heap use", cmd_time},
+    {"repeat", "[n] [cmd ...] run cmd n times and print min, average and max time", cmd_repeat},
+    {"dump", "[address] [len] print len bytes of memory in hex and ascii", cmd_dump},
+    {"fill", "[address] [len] [byte] set len bytes of memory to byte", cmd_fill},
+    {"copy", "[dst] [src] [len] copy len bytes of memory from src to dst", cmd_copy},
+    {"cmp", "[a] [b] [len] compare len bytes of memory at a and b", cmd_cmp},
+    {"crc", "[address] [len] print the CRC-32 of len bytes of memory", cmd_crc},
+    {"run", "[address|uart] run a script of commands from memory or the uart", cmd_run},
 };
 
 int cmd_echo(int argc, const char *argv[]) 
@@ -42,11 +82,10 @@ int cmd_help(int argc, const char *argv[])
     }
 
     const char *command = argv[1];
-    for (int i = 0; i < (sizeof(commands) / sizeof(command_t)); i++) {
-        if (strcmp(command, commands[i].name) == 0) {
-            shell_printf("%s: %s\n", commands[i].name, commands[i].description);
-            return 0;
-        }
+    const command_t *cmd = find_command(command);
+    if (cmd) {
+        shell_printf("%s: %s\n", cmd->name, cmd->description);
+        return 0;
     }
 
     // specified invalid command
@@ -131,9 +170,479 @@ int cmd_poke(int argc, const char *argv[])
     return 0;
 }
 
+static int cmd_rbstat(int argc, const char *argv[])
+{
+    rb_stats_t stats;
+    for (int i = 0; rb_get_stats(i, &stats); i++) {
+        shell_printf("%s: %d/%d queued, high water %d, dropped %d\n",
+                     stats.name, stats.count, stats.capacity, stats.high_water, stats.drops);
+    }
+    return 0;
+}
+
+// helper function to print the non-empty buckets of a latency histogram
+static void print_latency(const char *name, const keyboard_latency_t *hist)
+{
+    shell_printf("%s: %d events, max %d us\n", name, hist->total, hist->max);
+    for (int i = 0; i < KEYBOARD_LATENCY_BUCKETS; i++) {
+        if (hist->counts[i] == 0) continue;
+        shell_printf("  < %d us: %d\n", 2 << i, hist->counts[i]);
+    }
+}
+
+static int cmd_latency(int argc, const char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            shell_printf("error: unknown option '%s'.\n", argv[1]);
+            return 1;
+        }
+        keyboard_reset_latency();
+        return 0;
+    }
+    print_latency("enqueue to consume", keyboard_get_queue_latency());
+    print_latency("consume to echo", keyboard_get_echo_latency());
+    return 0;
+}
+
+// helper function for the FNV-1a hash of a name mixed with a seed
+static unsigned int hash_name(const char *name, unsigned int seed)
+{
+    unsigned int h = 2166136261u ^ seed;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// helper function to fill hash_table using `seed`, returns
+// false if two command names land in the same slot
+static bool try_hash_seed(unsigned int seed)
+{
+    int ncommands = sizeof(commands) / sizeof(command_t);
+    memset(hash_table, 0, hash_slots * sizeof(hash_table[0]));
+    for (int i = 0; i < ncommands; i++) {
+        unsigned int slot = hash_name(commands[i].name, seed) & (hash_slots - 1);
+        if (hash_table[slot]) return false;
+        hash_table[slot] = i + 1;
+    }
+    hash_seed = seed;
+    return true;
+}
+
+// helper function to search for a perfect hash of the command names.
+// If none turns up find_command() falls back to checking every name.
+static void build_command_hash(void)
+{
+    int ncommands = sizeof(commands) / sizeof(command_t);
+    // a table four times the number of names keeps the search short
+    for (hash_slots = MIN_HASH_SLOTS; hash_slots <= MAX_HASH_SLOTS; hash_slots *= 2) {
+        if (hash_slots < 4 * ncommands) continue;
+        for (unsigned int seed = 0; seed < MAX_SEED_TRIES; seed++) {
+            if (try_hash_seed(seed)) return;
+        }
+    }
+    hash_slots = 0;
+}
+
+static const command_t *find_command(const char *name)
+{
+    if (hash_slots == 0) {
+        for (int i = 0; i < (sizeof(commands) / sizeof(command_t)); i++) {
+            if (strcmp(name, commands[i].name) == 0) return &commands[i];
+        }
+        return NULL;
+    }
+
+    int index = hash_table[hash_name(name, hash_seed) & (hash_slots - 1)];
+    if (index && strcmp(name, commands[index - 1].name) == 0) {
+        return &commands[index - 1];
+    }
+    return NULL;
+}
+
+// helper function to print nanoseconds as microseconds
+static void print_us(unsigned int ns)
+{
+    shell_printf("%d.%03d", ns / 1000, ns % 1000);
+}
+
+// helper function to run one benchmark and print its results
+static void run_bench(const bench_t *bench, int nsamples)
+{
+    bench_result_t result;
+    shell_printf("%s: ", bench->name);
+    if (!bench_run(bench, nsamples, &result)) {
+        shell_printf("skipped, needs gl\n");
+        return;
+    }
+    shell_printf("min ");
+    print_us(result.min_ns);
+    shell_printf(" median ");
+    print_us(result.median_ns);
+    shell_printf(" max ");
+    print_us(result.max_ns);
+    shell_printf(" us");
+    if (result.mb_per_s) shell_printf(", %d MB/s", result.mb_per_s);
+    shell_printf(" (%d x %d)\n", nsamples, result.reps);
+}
+
+static int cmd_bench(int argc, const char *argv[])
+{
+    if (argc == 1) {
+        for (int i = 0; i < bench_count(); i++) {
+            shell_printf("%s\n", bench_get(i)->name);
+        }
+        return 0;
+    }
+
+    int nsamples = 11;
+    if (argc > 2) {
+        const char *end;
+        nsamples = strtonum(argv[2], &end);
+        if (*end != '\0' || nsamples < 1 || nsamples > BENCH_MAX_SAMPLES) {
+            shell_printf("error: samples must be 1 to %d.\n", BENCH_MAX_SAMPLES);
+            return 1;
+        }
+    }
+
+    shell_printf("time per op in microseconds (us) over %d samples, samples x reps per sample\n", nsamples);
+    if (strcmp(argv[1], "all") == 0) {
+        for (int i = 0; i < bench_count(); i++) {
+            run_bench(bench_get(i), nsamples);
+        }
+    } else {
+        const bench_t *bench = bench_find(argv[1]);
+        if (!bench) {
+            shell_printf("error: no such benchmark '%s'.\n", argv[1]);
+            return 1;
+        }
+        run_bench(bench, nsamples);
+    }
+
+    // gl benchmarks draw over the console
+    if (shell_printf == console_printf) {
+        console_redraw();
+    }
+    return 0;
+}
+
+static int cmd_time(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        shell_printf("error: time needs a command.\n");
+        return 1;
+    }
+
+    malloc_counters_t before = malloc_get_counters();
+    unsigned int start = timer_get_ticks();
+    int status = run_command(argc - 1, argv + 1);
+    unsigned int elapsed = timer_get_ticks() - start;
+    malloc_counters_t after = malloc_get_counters();
+
+    shell_printf("time: %d us, heap %d bytes in %d allocs, %d bytes in %d frees\n",
+                 elapsed,
+                 after.bytes_allocated - before.bytes_allocated, after.allocs - before.allocs,
+                 after.bytes_freed - before.bytes_freed, after.frees - before.frees);
+    return status;
+}
+
+static int cmd_repeat(int argc, const char *argv[])
+{
+    const char *end;
+    int n = (argc > 1) ? strtonum(argv[1], &end) : 0;
+    if (argc < 3 || *end != '\0' || n < 1) {
+        shell_printf("error: usage is repeat [n] [cmd ...].\n");
+        return 1;
+    }
+
+    unsigned int min = 0xFFFFFFFF;
+    unsigned int max = 0;
+    unsigned long long total = 0;
+    int status = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int start = timer_get_ticks();
+        status = run_command(argc - 2, argv + 2);
+        unsigned int elapsed = timer_get_ticks() - start;
+        if (elapsed < min) min = elapsed;
+        if (elapsed > max) max = elapsed;
+        total += elapsed;
+    }
+
+    shell_printf("repeat: %d runs, min %d us, average %d us, max %d us\n",
+                 n, min, (unsigned int) (total / n), max);
+    return status;
+}
+
+// helper function to convert the arguments after the command name,
+// printing an error naming the first that isn't a number
+static bool parse_numbers(int argc, const char *argv[], unsigned int values[], int n, const char *usage)
+{
+    if (argc != n + 1) {
+        shell_printf("error: %s expects %d arguments %s\n", argv[0], n, usage);
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        const char *end;
+        values[i] = strtonum(argv[i + 1], &end);
+        if (*argv[i + 1] == '\0' || *end != '\0') {
+            shell_printf("error: %s cannot convert '%s'.\n", argv[0], argv[i + 1]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// helper function to print one row of a dump, up to 16 bytes. The row
+// is formatted here so it goes out in a single shell_printf.
+static void print_dump_row(const unsigned char *p, int n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char row[16 * 3 + 1 + 16 + 2];
+    int len = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (i < n) {
+            row[len++] = hex[p[i] >> 4];
+            row[len++] = hex[p[i] & 0xF];
+        } else {
+            row[len++] = ' ';
+            row[len++] = ' ';
+        }
+        row[len++] = ' ';
+    }
+    row[len++] = '|';
+    for (int i = 0; i < n; i++) {
+        row[len++] = (p[i] >= 0x20 && p[i] < 0x7F) ? p[i] : '.';
+    }
+    row[len++] = '|';
+    row[len] = '\0';
+    shell_printf("%08x: %s\n", (unsigned int) p, row);
+}
+
+static int cmd_dump(int argc, const char *argv[])
+{
+    unsigned int args[2];
+    if (!parse_numbers(argc, argv, args, 2, "[address] [len]")) return 1;
+
+    const unsigned char *p = (const unsigned char *) args[0];
+    unsigned int len = args[1];
+    while (len > 0) {
+        int n = len < 16 ? len : 16;
+        print_dump_row(p, n);
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int cmd_fill(int argc, const char *argv[])
+{
+    unsigned int args[3];
+    if (!parse_numbers(argc, argv, args, 3, "[address] [len] [byte]")) return 1;
+    if (args[2] > 0xFF) {
+        shell_printf("error: fill value must be a byte\n");
+        return 1;
+    }
+
+    memset((void *) args[0], args[2], args[1]);
+    return 0;
+}
+
+static int cmd_copy(int argc, const char *argv[])
+{
+    unsigned int args[3];
+    if (!parse_numbers(argc, argv, args, 3, "[dst] [src] [len]")) return 1;
+
+    unsigned char *dst = (unsigned char *) args[0];
+    const unsigned char *src = (const unsigned char *) args[1];
+    unsigned int len = args[2];
+
+    // memcpy goes forwards, so a destination overlapping the end of the
+    // source is copied backwards instead
+    if (dst > src && dst < src + len) {
+        while (len-- > 0) {
+            dst[len] = src[len];
+        }
+    } else {
+        memcpy(dst, src, len);
+    }
+    return 0;
+}
+
+static int cmd_cmp(int argc, const char *argv[])
+{
+    unsigned int args[3];
+    if (!parse_numbers(argc, argv, args, 3, "[a] [b] [len]")) return 1;
+
+    const unsigned char *a = (const unsigned char *) args[0];
+    const unsigned char *b = (const unsigned char *) args[1];
+    unsigned int len = args[2];
+    unsigned int i = 0;
+
+    // skip equal words while both are aligned, then find the byte
+    if ((((unsigned int) a | (unsigned int) b) & 3) == 0) {
+        while (i + 4 <= len && *(const unsigned int *) (a + i) == *(const unsigned int *) (b + i)) {
+            i += 4;
+        }
+    }
+    while (i < len && a[i] == b[i]) {
+        i++;
+    }
+
+    if (i == len) {
+        shell_printf("cmp: %d bytes are the same\n", len);
+        return 0;
+    }
+    unsigned int differ = 0;
+    for (unsigned int j = i; j < len; j++) {
+        if (a[j] != b[j]) differ++;
+    }
+    shell_printf("cmp: first difference at offset %x, %p: %02x %p: %02x, %d bytes differ\n",
+                 i, a + i, a[i], b + i, b[i], differ);
+    return 1;
+}
+
+// helper function to compute the CRC-32 (as used by zip and ethernet)
+// of `len` bytes, a nibble at a time from a 16 entry table
+static unsigned int crc32(const unsigned char *p, unsigned int len)
+{
+    static const unsigned int table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    unsigned int crc = 0xFFFFFFFF;
+    while (len-- > 0) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0xF];
+        crc = (crc >> 4) ^ table[crc & 0xF];
+    }
+    return ~crc;
+}
+
+static int cmd_crc(int argc, const char *argv[])
+{
+    unsigned int args[2];
+    if (!parse_numbers(argc, argv, args, 2, "[address] [len]")) return 1;
+
+    shell_printf("crc: %08x\n", crc32((const unsigned char *) args[0], args[1]));
+    return 0;
+}
+
+// Output of a script run is collected here and printed in large chunks
+// when the buffer fills and at the end, rather than a line at a time.
+// The printers format into 1024 byte buffers, so flush below that.
+#define RUN_OUTPUT_LEN 8192
+#define RUN_FLUSH_CHUNK 512
+#define EOT 0x04
+static char run_output[RUN_OUTPUT_LEN];
+static int run_output_len = 0;
+static formatted_fn_t run_printf = 0;
+
+// helper function to print and empty the script output buffer
+static void flush_run_output(void)
+{
+    for (int i = 0; i < run_output_len; i += RUN_FLUSH_CHUNK) {
+        int n = run_output_len - i < RUN_FLUSH_CHUNK ? run_output_len - i : RUN_FLUSH_CHUNK;
+        char saved = run_output[i + n];
+        run_output[i + n] = '\0';
+        run_printf("%s", run_output + i);
+        run_output[i + n] = saved;
+    }
+    run_output_len = 0;
+}
+
+// stands in for shell_printf while a script runs
+static int buffered_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(run_output + run_output_len, RUN_OUTPUT_LEN - run_output_len, format, args);
+    va_end(args);
+
+    // didn't fit, make room and format it again
+    if (run_output_len + len >= RUN_OUTPUT_LEN) {
+        flush_run_output();
+        va_start(args, format);
+        len = vsnprintf(run_output, RUN_OUTPUT_LEN, format, args);
+        va_end(args);
+        if (len >= RUN_OUTPUT_LEN) len = RUN_OUTPUT_LEN - 1;
+    }
+    run_output_len += len;
+    return len;
+}
+
+// helper function to run one line of a script, skipping # comments.
+// Returns 1 if the line failed.
+static int run_script_line(char *line, int len, int lineno)
+{
+    if (len >= LINE_LEN) {
+        shell_printf("error: line %d longer than %d characters.\n", lineno, LINE_LEN - 1);
+        return 1;
+    }
+    line[len] = '\0';
+    if (line[0] == '#') return 0;
+    return shell_evaluate(line) != 0;
+}
+
+static int cmd_run(int argc, const char *argv[])
+{
+    const char *script = 0;
+    if (argc != 2) {
+        shell_printf("error: run expects 1 argument [address|uart]\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "uart") != 0) {
+        const char *end;
+        script = (const char *) strtonum(argv[1], &end);
+        if (*end != '\0') {
+            shell_printf("error: run cannot convert '%s'.\n", argv[1]);
+            return 1;
+        }
+    }
+    if (run_printf) {
+        shell_printf("error: run cannot be nested\n");
+        return 1;
+    }
+
+    // A script in memory ends at a null, one sent over the uart at an
+    // EOT (ctrl-D). Lines run as they complete, nothing is echoed.
+    run_printf = shell_printf;
+    shell_printf = buffered_printf;
+    char line[LINE_LEN];
+    int len = 0;
+    int lineno = 0;
+    int failed = 0;
+    while (1) {
+        int ch = script ? *script++ : uart_getchar();
+        bool at_end = (ch == '\0' || ch == EOT);
+        // no line after a final newline
+        if (at_end && len == 0) break;
+        if (at_end || ch == '\n') {
+            lineno++;
+            failed += run_script_line(line, len, lineno);
+            len = 0;
+            if (at_end) break;
+        } else if (ch != '\r') {
+            // keep counting past the end so the line is reported as too long
+            if (len < LINE_LEN - 1) line[len] = ch;
+            if (len < LINE_LEN) len++;
+        }
+    }
+    shell_printf("run: %d lines, %d failed\n", lineno, failed);
+    flush_run_output();
+    shell_printf = run_printf;
+    run_printf = 0;
+    return failed != 0;
+}
+
 void shell_init(formatted_fn_t print_fn)
 {
     shell_printf = print_fn;
+    build_command_hash();
 }
 
 void shell_bell(void)
@@ -141,51 +650,260 @@ void shell_bell(void)
     uart_putchar('\a');
 }
 
+// Previous lines, newest last. Line i of all history_count lines
+// entered is in history[i % HISTORY_LEN] while it is one of the last
+// HISTORY_LEN.
+#define HISTORY_LEN 16
+static char history[HISTORY_LEN][LINE_LEN];
+static int history_count = 0;
+
+// helper function to copy at most `max` - 1 chars of `src`
+static int copy_line(char *dst, const char *src, int max)
+{
+    int len = strlen(src);
+    if (len > max - 1) len = max - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return len;
+}
+
+// Where the line being edited is on screen. Offsets count chars from
+// the start of the line, which is `start` columns into its first row.
+// A line longer than a row wraps, so cursor moves go up and down rows
+// as well as across. After a char fills the last column the cursor
+// waits there to wrap (`wrap_pending`) until the next char.
+static struct {
+    int start;
+    int ncols;
+    int shown;          // chars of the line drawn so far
+    int at;             // offset of the cursor
+    bool wrap_pending;
+} view;
+
+// The escapes and text of one edit are collected here and printed
+// together, so the console redraws once per keystroke.
+#define EDIT_OUT_LEN 256
+static char edit_out[EDIT_OUT_LEN];
+static int edit_out_len = 0;
+
+// off the console the width isn't known, take rows as never wrapping
+#define UNKNOWN_WIDTH 0x10000
+
+// helper function to print what the last edit collected
+static void flush_edit(void)
+{
+    if (edit_out_len == 0) return;
+    edit_out[edit_out_len] = '\0';
+    shell_printf("%s", edit_out);
+    edit_out_len = 0;
+}
+
+static void append_edit(const char *str, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (edit_out_len == EDIT_OUT_LEN - 1) flush_edit();
+        edit_out[edit_out_len++] = str[i];
+    }
+}
+
+// helper function to add a cursor movement of `n` in direction `dir`
+static void append_move(int n, char dir)
+{
+    if (n == 0) return;
+    char esc[16];
+    int len = snprintf(esc, sizeof(esc), "\x1b[%d%c", n, dir);
+    append_edit(esc, len);
+}
+
+// helper function to start a view of a new line at the cursor
+static void begin_view(void)
+{
+    if (shell_printf == console_printf) {
+        view.start = console_get_column();
+        view.ncols = console_get_width();
+    } else {
+        view.start = 0;
+        view.ncols = UNKNOWN_WIDTH;
+    }
+    view.shown = 0;
+    view.at = 0;
+    view.wrap_pending = (view.start > 0 && view.start % view.ncols == 0);
+}
+
+// helper function to move the cursor to offset `pos` of `buf`
+static void move_to(const char *buf, int pos)
+{
+    if (pos == view.at) return;
+
+    // the end of a line that fills its last row is the start of a row
+    // that may not exist yet, get there by drawing the last char again
+    if (pos == view.shown && pos > 0 && (view.start + pos) % view.ncols == 0) {
+        move_to(buf, pos - 1);
+        append_edit(buf + pos - 1, 1);
+        view.at = pos;
+        view.wrap_pending = true;
+        return;
+    }
+
+    int from = view.start + view.at;
+    int row = from / view.ncols;
+    int col = from % view.ncols;
+    // a cursor waiting to wrap is still at the end of the row above
+    if (view.wrap_pending) {
+        row--;
+        col = view.ncols - 1;
+    }
+    int to = view.start + pos;
+    int drow = to / view.ncols - row;
+    int dcol = to % view.ncols - col;
+
+    append_move(drow < 0 ? -drow : drow, drow < 0 ? 'A' : 'B');
+    append_move(dcol < 0 ? -dcol : dcol, dcol < 0 ? 'D' : 'C');
+    // no movement still has to end the wait to wrap
+    if (view.wrap_pending && drow == 0 && dcol == 0) {
+        append_move(1, 'D');
+        append_move(1, 'C');
+    }
+    view.at = pos;
+    view.wrap_pending = false;
+}
+
+// helper function to draw the line from offset `pos` to its end after
+// an edit there, blanking chars left over from a longer line
+static void draw_from(const char *buf, int len, int pos)
+{
+    move_to(buf, pos);
+    append_edit(buf + pos, len - pos);
+    int end = len;
+    while (end < view.shown) {
+        append_edit(" ", 1);
+        end++;
+    }
+    if (end > pos) {
+        view.at = end;
+        view.wrap_pending = ((view.start + end) % view.ncols == 0);
+    }
+    view.shown = len;
+}
+
+// helper function to replace the whole line with `line`, cursor at the end
+static int replace_line(char buf[], int bufsize, const char *line)
+{
+    int len = copy_line(buf, line, bufsize < LINE_LEN ? bufsize : LINE_LEN);
+    draw_from(buf, len, 0);
+    move_to(buf, len);
+    return len;
+}
+
+// helper function to add a line to the history, skipping empty lines and
+// repeats of the previous one
+static void add_history(const char *line)
+{
+    if (line[0] == '\0') return;
+    if (history_count > 0 && strcmp(history[(history_count - 1) % HISTORY_LEN], line) == 0) return;
+    copy_line(history[history_count % HISTORY_LEN], line, LINE_LEN);
+    history_count++;
+}
+
 // I diverged from assign5 since I used uart instead of shell_printf
 void shell_readline(char buf[], int bufsize)
 {
     int len = 0;
-    while (len < bufsize - 1) {
+    int pos = 0;
+    buf[0] = '\0';
+
+    // the history line being shown, history_count is the line being typed
+    int recall = history_count;
+    int oldest = history_count > HISTORY_LEN ? history_count - HISTORY_LEN : 0;
+    char draft[LINE_LEN];
+
+    begin_view();
+    while (1) {
         unsigned char char_read = keyboard_read_next();
-        // don't print out non-characters
-        if (char_read >= 0x90) continue;
+        // page up/down move through the console's scrollback
+        if (char_read == PS2_KEY_PAGE_UP || char_read == PS2_KEY_PAGE_DOWN) {
+            if (shell_printf == console_printf) {
+                console_page_history(char_read == PS2_KEY_PAGE_UP ? 1 : -1);
+            }
+            continue;
+        }
+        // typing goes back to the live screen
+        if (shell_printf == console_printf) {
+            console_show_live();
+        }
+
         if (char_read == '\n') {
-            shell_printf("%c", char_read);
+            move_to(buf, len);
+            append_edit("\n", 1);
+            flush_edit();
+            keyboard_record_echo();
             break;
-        }
-        // delete a character
-        if (char_read == '\b') {
-            // don't delete nonexistent character
-            if (len == 0) {
+        } else if (char_read == PS2_KEY_ARROW_LEFT || char_read == PS2_KEY_HOME) {
+            if (pos == 0) {
                 shell_bell();
                 continue;
-            } else {
-                shell_printf("%c", char_read);
-                shell_printf("%c", ' ');
-                len -= 1;
             }
-        } else {
-            buf[len] = char_read;
+            pos = (char_read == PS2_KEY_HOME) ? 0 : pos - 1;
+            move_to(buf, pos);
+        } else if (char_read == PS2_KEY_ARROW_RIGHT || char_read == PS2_KEY_END) {
+            if (pos == len) {
+                shell_bell();
+                continue;
+            }
+            pos = (char_read == PS2_KEY_END) ? len : pos + 1;
+            move_to(buf, pos);
+        } else if (char_read == PS2_KEY_ARROW_UP || char_read == PS2_KEY_ARROW_DOWN) {
+            int next = recall + (char_read == PS2_KEY_ARROW_UP ? -1 : 1);
+            if (next < oldest || next > history_count) {
+                shell_bell();
+                continue;
+            }
+            // keep what was being typed to come back to
+            if (recall == history_count) copy_line(draft, buf, LINE_LEN);
+            recall = next;
+            const char *line = (recall == history_count) ? draft : history[recall % HISTORY_LEN];
+            len = pos = replace_line(buf, bufsize, line);
+        } else if (char_read == '\b' || char_read == PS2_KEY_DELETE) {
+            // backspace removes the char before the cursor, delete the one under it
+            if (char_read == '\b') {
+                if (pos == 0) {
+                    shell_bell();
+                    continue;
+                }
+                pos--;
+            } else if (pos == len) {
+                shell_bell();
+                continue;
+            }
+            for (int i = pos; i < len; i++) {
+                buf[i] = buf[i + 1];
+            }
+            len--;
+            draw_from(buf, len, pos);
+            move_to(buf, pos);
+        } else if (char_read < 0x90 && char_read != PS2_KEY_ESC) {
+            if (len == bufsize - 1) {
+                shell_bell();
+                continue;
+            }
+            // open a gap at the cursor
+            for (int i = len; i >= pos; i--) {
+                buf[i + 1] = buf[i];
+            }
+            buf[pos] = char_read;
             len++;
+            draw_from(buf, len, pos);
+            pos++;
+            move_to(buf, pos);
+        } else {
+            // don't print out other non-characters
+            continue;
         }
-        shell_printf("%c", char_read);
+        flush_edit();
+        keyboard_record_echo();
     }
     buf[len] = '\0';
-}
-
-// helper function for tokenize
-static char *strndup(const char *src, int n)
-{
-    if (n >= strlen(src)) {
-        n = strlen(src);
-    }
-    char *cpy = malloc(n + 1);
-    int i;
-    for (i = 0; i < n; i++) {
-        cpy[i] = src[i];
-    }
-    cpy[i] = '\0';
-    return cpy;
+    add_history(buf);
 }
 
 // helper function for tokenize
@@ -194,17 +912,37 @@ static int isspace(char ch)
     return ch == ' ' || ch == '\t' || ch == '\n';
 }
 
-static int tokenize(const char *line, char *tokens[],  int max)
+// Splits `line` in place: each token is NUL-terminated where it ends
+// and `tokens` points into `line`. Quotes group words into one token and
+// are removed, so 'a b'"c" is the token `a bc`. Returns -1 if a quote
+// isn't closed or there are more than `max` tokens.
+static int tokenize(char *line, char *tokens[],  int max)
 {
     int ntokens = 0;
-
-    while (*line != '\0' && ntokens < max) {
-        while (isspace(*line)) line++;
-        if (*line == '\0') break;
-        const char *start = line;
-        while (*line != '\0' && !isspace(*line)) line++;
-        int nchars = line - start;
-        tokens[ntokens++] = strndup(start, nchars);
+    char *src = line;
+    while (*src != '\0') {
+        while (isspace(*src)) src++;
+        if (*src == '\0') break;
+        if (ntokens == max) return -1;
+
+        // token is copied down over the quotes as it is read
+        char *dst = src;
+        tokens[ntokens++] = dst;
+        char quote = 0;
+        while (*src != '\0' && (quote || !isspace(*src))) {
+            if (quote && *src == quote) {
+                quote = 0;
+            } else if (!quote && (*src == '"' || *src == '\'')) {
+                quote = *src;
+            } else {
+                *dst++ = *src;
+            }
+            src++;
+        }
+        if (quote) return -1;
+        // the separator, if any, was already read past
+        if (*src != '\0') src++;
+        *dst = '\0';
     }
     return ntokens;
 }
@@ -215,32 +953,30 @@ int shell_evaluate(const char *line)
     // if line is empty do nothing
     if (len == 0) return 0;
 
-    char *tokens[LINE_LEN];
-    // will use malloc to store token strings
-    int ntokens = tokenize(line, tokens, LINE_LEN);
-
-    char *command = tokens[0];
-    int command_not_found = 1;
-    int status = 0;
-    for (int i = 0; i < (sizeof(commands) / sizeof(command_t)); i++) {
-        if (strcmp(command, commands[i].name) == 0) {
-            command_not_found = 0;
-            status = commands[i].fn(ntokens, (const char **) tokens);
-            break;
-        }
-    }
-
-    if (command_not_found) {
-        shell_printf("error: no such command '%s'.\n", command);
+    // tokens point into this copy of the line, nothing is allocated.
+    // Tokens are separated, so a line has at most half its length + 1.
+    char buf[len + 1];
+    memcpy(buf, line, len + 1);
+    char *tokens[len / 2 + 1];
+    int ntokens = tokenize(buf, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    if (ntokens < 0) {
+        shell_printf("error: unmatched quote.\n");
         return 1;
     }
+    if (ntokens == 0) return 0;
+
+    return run_command(ntokens, (const char **) tokens);
+}
 
-    // must free memory when done with tokens
-    for (int i = 0; i < ntokens; i++) {
-        free(tokens[i]);
+// helper function to run the command named by argv[0]
+static int run_command(int argc, const char *argv[])
+{
+    const command_t *cmd = find_command(argv[0]);
+    if (!cmd) {
+        shell_printf("error: no such command '%s'.\n", argv[0]);
+        return 1;
     }
-    
-    return status;
+    return cmd->fn(argc, argv);
 }
 
 void shell_run(void)
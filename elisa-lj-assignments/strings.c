@@ -1,8 +1,31 @@
 #include "strings.h"
 
+// word accesses through this type may alias any other object
+typedef unsigned int __attribute__((may_alias)) word_t;
+
 void *memset(void *s, int c, size_t n)
 {
     unsigned char *p = (unsigned char *) s;
+    // bytes up to the first aligned word, then whole words
+    while (n > 0 && ((unsigned int) p & 3)) {
+        *p++ = (unsigned char) c;
+        n--;
+    }
+    word_t pattern = (unsigned char) c * 0x01010101u;
+    word_t *w = (word_t *) p;
+    while (n >= 16) {
+        w[0] = pattern;
+        w[1] = pattern;
+        w[2] = pattern;
+        w[3] = pattern;
+        w += 4;
+        n -= 16;
+    }
+    while (n >= 4) {
+        *w++ = pattern;
+        n -= 4;
+    }
+    p = (unsigned char *) w;
     while (n--) {
         *p++ = (unsigned char) c;
     }
@@ -11,14 +34,37 @@ void *memset(void *s, int c, size_t n)
 
 void *memcpy(void *dst, const void *src, size_t n)
 {
-    // Typecast src and dst addresses 
-    unsigned char *csrc = (unsigned char *) src; 
-    unsigned char *cdst = (unsigned char *) dst; 
-  
-    // Copy contents of src[] to dst[] 
-    int i;
-    for (i = 0; i < n; i++) {
-        cdst[i] = csrc[i];
+    unsigned char *cdst = (unsigned char *) dst;
+    const unsigned char *csrc = (const unsigned char *) src;
+
+    // words at a time needs both to reach alignment together
+    if ((((unsigned int) cdst ^ (unsigned int) csrc) & 3) == 0) {
+        while (n > 0 && ((unsigned int) cdst & 3)) {
+            *cdst++ = *csrc++;
+            n--;
+        }
+        word_t *wdst = (word_t *) cdst;
+        const word_t *wsrc = (const word_t *) csrc;
+        while (n >= 16) {
+            wdst[0] = wsrc[0];
+            wdst[1] = wsrc[1];
+            wdst[2] = wsrc[2];
+            wdst[3] = wsrc[3];
+            wdst += 4;
+            wsrc += 4;
+            n -= 16;
+        }
+        while (n >= 4) {
+            *wdst++ = *wsrc++;
+            n -= 4;
+        }
+        cdst = (unsigned char *) wdst;
+        csrc = (const unsigned char *) wsrc;
+    }
+
+    // whatever is left, or everything if they can't both be aligned
+    while (n--) {
+        *cdst++ = *csrc++;
     }
     return dst;
 }
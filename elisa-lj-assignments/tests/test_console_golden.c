@@ -0,0 +1,93 @@
+#include "console.h"
+#include "consoleextra.h"
+#include "glextra.h"
+#include "printf.h"
+#include "host/hostfb.h"
+
+/*
+ * Native test of console and gl rendering, built with `make host-test`
+ * against the emulated GPU in host/. Each case prints to a small console
+ * and compares the frame being shown against a golden PPM image in the
+ * given directory. Pass --update to rewrite the golden images after an
+ * intended change in rendering, and check them by eye before committing.
+ */
+
+#define NROWS 4
+#define NCOLS 12
+
+// text wraps, scrolls and is partly erased with backspace
+static void draw_basic(void)
+{
+    console_set_mode(GL_SCROLLBUFFER);
+    console_init(NROWS, NCOLS);
+    console_printf("first line\nsecond line\n");
+    console_printf("this one is long enough to wrap\n");
+    console_printf("oops!!\b\b\b done");
+}
+
+// colors and cursor movement, drawn double buffered
+static void draw_ansi(void)
+{
+    console_set_mode(GL_DOUBLEBUFFER);
+    console_init(NROWS, NCOLS);
+    console_printf("status: \x1b[31mbad\x1b[0m\nbackground\n");
+    console_printf("\x1b[1;9H\x1b[K\x1b[1;32mok\x1b[0m");
+    console_printf("\x1b[2;1H\x1b[44m\x1b[2K blue row \x1b[0m");
+    console_printf("\x1b[4;1Hlast");
+}
+
+// a color change after a full row keeps the wrap, and a bare SGR resets
+static void draw_sgr_wrap(void)
+{
+    console_set_mode(GL_SCROLLBUFFER);
+    console_init(NROWS, NCOLS);
+    console_printf("twelve chars\x1b[31m");
+    console_printf("red\x1b[m plain\n");
+}
+
+static const struct {
+    const char *name;
+    void (*draw)(void);
+} cases[] = {
+    {"console_basic", draw_basic},
+    {"console_ansi", draw_ansi},
+    {"console_sgr_wrap", draw_sgr_wrap},
+};
+
+int main(int argc, char *argv[])
+{
+    const char *dir = "tests/golden";
+    int update = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == '-' && argv[i][2] == 'u') {
+            update = 1;
+        } else {
+            dir = argv[i];
+        }
+    }
+
+    int failures = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s.ppm", dir, cases[i].name);
+        cases[i].draw();
+
+        if (update) {
+            printf("%s: %s\n", hostfb_dump_ppm(path) ? "wrote" : "FAILED to write", path);
+            continue;
+        }
+        int ndiff = hostfb_compare_ppm(path);
+        if (ndiff == 0) {
+            printf("PASS %s\n", cases[i].name);
+        } else {
+            printf("FAIL %s: ", cases[i].name);
+            if (ndiff < 0) {
+                printf("cannot read %s\n", path);
+            } else {
+                printf("%d pixels differ from %s\n", ndiff, path);
+            }
+            failures++;
+        }
+    }
+    return failures;
+}
@@ -1,6 +1,7 @@
 #include "timer.h"
 #include "uart.h"
 #include "keyboard.h"
+#include "keyboardextra.h"
 #include "printf.h"
 
 
@@ -11,6 +12,10 @@
  * is waiting in delay is simply dropped. Once you upgrade your
  * keyboard implementation to be interrupt-driven, those keys should
  * be queued up and can be read after delay finishes.
+ *
+ * It also reports the worst lateness with which a PS/2 clock edge was
+ * handled, to compare the IRQ and FIQ paths (KEYBOARD_USE_FIQ in
+ * keyboard.c). Keys typed during the delay show the worst case.
  */
 void main(void)
 {
@@ -23,6 +28,7 @@ void main(void)
         uart_flush();
         char ch = keyboard_read_next();
         printf("\nRead: %c\n", ch);
+        printf("Worst clock edge latency so far: %d us\n", keyboard_get_edge_latency());
         if (ch == 'q') break;
         printf("Test program will now pause for 1 second... ");
         uart_flush();
@@ -0,0 +1,217 @@
+#include "ps2decoder.h"
+#include "printf.h"
+#include "timer.h"
+
+/*
+ * Native simulator for the PS/2 frame decoder, built and run by
+ * `make host-test`. Frames are clocked into ps2decoder.c bit by bit
+ * with simulated edge times: clean frames, parity errors, low stop bits
+ * and glitches that add or lose a clock edge. Reports decode throughput
+ * and how many frames it takes to recover from each fault, then fuzzes
+ * random streams at sustained rates looking for the decoder losing
+ * frame alignment for good.
+ */
+
+#define BIT_PERIOD_US 80
+#define NUM_FRAMES 1000000
+#define NUM_RECOVERIES 10000
+#define NUM_FUZZ_FRAMES 500000
+#define MAX_RECOVERY 50
+
+typedef enum {
+    SEND_CLEAN,
+    SEND_BAD_PARITY,
+    SEND_BAD_STOP,
+    SEND_EXTRA_EDGE,
+    SEND_LOST_EDGE,
+    NUM_FAULTS,
+} fault_t;
+
+static const char *fault_names[NUM_FAULTS] = {
+    "clean", "bad parity", "bad stop", "extra edge", "lost edge",
+};
+
+static ps2_decoder_t dec;
+static unsigned int now;
+
+// frames the decoder handed back while the last frame was sent
+static int num_decoded;
+static unsigned char last_decoded;
+
+static unsigned int rand_state = 0x2545F491;
+
+// helper function for a xorshift random number in [0, n)
+static unsigned int rand_below(unsigned int n)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state % n;
+}
+
+// helper function to clock one edge into the decoder
+static void send_edge(unsigned int data)
+{
+    unsigned char scancode;
+    if (ps2_decoder_edge(&dec, data, now, &scancode) == PS2_DECODER_FRAME) {
+        num_decoded++;
+        last_decoded = scancode;
+    }
+    now += BIT_PERIOD_US;
+}
+
+// helper function to send one frame of `byte` with `fault`, after the
+// line has been idle for `gap_us` since the previous frame's last edge
+static void send_frame(unsigned char byte, fault_t fault, unsigned int gap_us)
+{
+    unsigned int bits[12];
+    int nbits = 0;
+    unsigned int parity = 1;
+
+    bits[nbits++] = 0;
+    for (int i = 0; i < 8; i++) {
+        bits[nbits] = (byte >> i) & 1;
+        parity ^= bits[nbits++];
+    }
+    bits[nbits++] = parity ^ (fault == SEND_BAD_PARITY);
+    bits[nbits++] = (fault != SEND_BAD_STOP);
+
+    if (fault == SEND_EXTRA_EDGE) {
+        int at = 1 + rand_below(nbits - 1);
+        for (int i = nbits; i > at; i--) bits[i] = bits[i - 1];
+        bits[at] = rand_below(2);
+        nbits++;
+    } else if (fault == SEND_LOST_EDGE) {
+        int at = rand_below(nbits);
+        for (int i = at; i < nbits - 1; i++) bits[i] = bits[i + 1];
+        nbits--;
+    }
+
+    now += gap_us - BIT_PERIOD_US;
+    num_decoded = 0;
+    for (int i = 0; i < nbits; i++) {
+        send_edge(bits[i]);
+    }
+}
+
+// helper function to start a run, with the clock about to wrap
+static void reset(void)
+{
+    ps2_decoder_init(&dec);
+    now = 0xFFFFFFFF - 100 * BIT_PERIOD_US;
+    dec.last_ticks = now;
+}
+
+// clean frames back to back must all decode
+static int test_throughput(void)
+{
+    reset();
+    int errors = 0;
+    unsigned int start = timer_get_ticks();
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        unsigned char byte = i * 7;
+        send_frame(byte, SEND_CLEAN, BIT_PERIOD_US);
+        if (num_decoded != 1 || last_decoded != byte) errors++;
+    }
+    unsigned int elapsed = timer_get_ticks() - start;
+    if (elapsed == 0) elapsed = 1;
+
+    printf("  %d frames in %d us, %d frames per ms\n",
+           NUM_FRAMES, elapsed, (int) (NUM_FRAMES * 1000ULL / elapsed));
+    return errors;
+}
+
+// helper function to count clean frames sent after a fault until one
+// decodes correctly, with `gap_us` between frames
+static int frames_to_recover(fault_t fault, unsigned int gap_us)
+{
+    send_frame(rand_below(256), fault, gap_us);
+    for (int n = 1; n <= MAX_RECOVERY; n++) {
+        unsigned char byte = rand_below(256);
+        send_frame(byte, SEND_CLEAN, gap_us);
+        if (num_decoded == 1 && last_decoded == byte) return n;
+    }
+    return MAX_RECOVERY + 1;
+}
+
+// After an idle gap longer than PS2_DECODER_RESYNC_US, the first clean
+// frame must decode whatever came before it. Back to back frames have no
+// such gap and a periodic bitstream gives no hint where frames start, so
+// those are only reported: realigning waits on a parity or stop error.
+static int test_recovery(void)
+{
+    int errors = 0;
+    for (fault_t fault = SEND_BAD_PARITY; fault < NUM_FAULTS; fault++) {
+        int worst_idle = 0;
+        int worst_busy = 0;
+        int total_busy = 0;
+        reset();
+        for (int i = 0; i < NUM_RECOVERIES; i++) {
+            int idle = frames_to_recover(fault, 2 * PS2_DECODER_RESYNC_US);
+            int busy = frames_to_recover(fault, BIT_PERIOD_US);
+            if (idle > worst_idle) worst_idle = idle;
+            if (busy > worst_busy) worst_busy = busy;
+            total_busy += busy;
+        }
+        bool gave_up = worst_busy > MAX_RECOVERY;
+        printf("  %s: after idle gap %d frame(s), back to back %d.%02d average, %s%d worst\n",
+               fault_names[fault], worst_idle, total_busy / NUM_RECOVERIES,
+               (total_busy % NUM_RECOVERIES) * 100 / NUM_RECOVERIES,
+               gave_up ? "over " : "", gave_up ? MAX_RECOVERY : worst_busy);
+        if (worst_idle != 1) errors++;
+    }
+    return errors;
+}
+
+// random faults at random rates, checking the decoder's invariants
+static int test_fuzz(void)
+{
+    int desyncs = 0;
+    int accepted_bad = 0;
+    int lost_busy = 0;
+    reset();
+    for (int i = 0; i < NUM_FUZZ_FRAMES; i++) {
+        fault_t fault = rand_below(10) == 0 ? 1 + rand_below(NUM_FAULTS - 1) : SEND_CLEAN;
+        unsigned int gap_us = BIT_PERIOD_US * (1 + rand_below(8));
+        unsigned char byte = rand_below(256);
+        send_frame(byte, fault, gap_us);
+
+        if (dec.cnt < 0 || dec.cnt > 10) desyncs++;
+        bool ok = (num_decoded == 1 && last_decoded == byte);
+        if (fault == SEND_CLEAN) {
+            if (!ok && gap_us > PS2_DECODER_RESYNC_US) desyncs++;
+            if (!ok && gap_us <= PS2_DECODER_RESYNC_US) lost_busy++;
+        } else if (num_decoded > 0 && !ok) {
+            accepted_bad++;
+        }
+    }
+    printf("  %d frames: %d clean frames lost back to back, %d corrupt frames accepted\n",
+           NUM_FUZZ_FRAMES, lost_busy, accepted_bad);
+    printf("  decoder counts: %d frames, %d parity errors, %d stop errors, %d resyncs\n",
+           dec.frames, dec.parity_errors, dec.stop_errors, dec.resyncs);
+    return desyncs;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} cases[] = {
+    {"ps2_throughput", test_throughput},
+    {"ps2_recovery", test_recovery},
+    {"ps2_fuzz", test_fuzz},
+};
+
+int main(int argc, char *argv[])
+{
+    int failures = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int errors = cases[i].run();
+        if (errors == 0) {
+            printf("PASS %s\n", cases[i].name);
+        } else {
+            printf("FAIL %s: %d errors\n", cases[i].name, errors);
+            failures++;
+        }
+    }
+    return failures;
+}
@@ -0,0 +1,393 @@
+#include "shell.h"
+#include "console.h"
+#include "consoleextra.h"
+#include "keyboard.h"
+#include "keyboardextra.h"
+#include "mallocextra.h"
+#include "ringbufferextra.h"
+#include "bench.h"
+#include "printf.h"
+#include "strings.h"
+#include "ps2.h"
+#include "uart.h"
+
+/*
+ * Native test of line editing in shell_readline, built and run by
+ * `make host-test`. Keys come from a script through a stand-in for
+ * keyboard_read_next, which before handing each one over checks the
+ * console against a model of the editor: the cells of the line's rows
+ * hold the prompt and the text being edited, and the cursor is at the
+ * edit position. Scripted edits check the model itself, then random
+ * keys are typed at console widths that wrap the line at every offset.
+ */
+
+#define NROWS 16
+#define PROMPT "Pi> "
+#define PROMPT_LEN 4
+#define MAX_LINE 48
+#define MODEL_HISTORY 16    // same as HISTORY_LEN in shell.c
+#define NUM_FUZZ_LINES 300
+#define MAX_REPORTS 5
+
+// the editor as the test expects it to be
+static struct {
+    char line[MAX_LINE];
+    int len;
+    int pos;
+    int maxlen;         // longest the line has been, rows it has drawn on
+    int bufsize;
+    char history[MODEL_HISTORY][MAX_LINE];
+    int count;
+    int recall;
+    int oldest;
+    char draft[MAX_LINE];
+    int bells;
+} model;
+
+// keys of the line being read and the buffer it is read into
+static const unsigned char *keys;
+static int nkeys;
+static int next_key;
+static char *line_buf;
+
+static unsigned int ncols;
+static int top;             // screen row the prompt was printed on
+static int num_bells;
+static int errors;
+
+static unsigned int rand_state = 0x2545F491;
+
+// helper function for a xorshift random number in [0, n)
+static unsigned int rand_below(unsigned int n)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state % n;
+}
+
+// helper function to report a mismatch, only the first few are printed
+static void report(const char *what)
+{
+    if (errors++ < MAX_REPORTS) {
+        printf("  width %d, key %d of \"%s\": %s\n", ncols, next_key, model.line, what);
+    }
+}
+
+// helper function to copy at most `max` - 1 chars like copy_line in shell.c
+static int copy_line(char *dst, const char *src, int max)
+{
+    int len = strlen(src);
+    if (len > max - 1) len = max - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return len;
+}
+
+// helper function to apply one key to the model
+static void model_key(unsigned char key)
+{
+    if (key == PS2_KEY_ARROW_LEFT || key == PS2_KEY_HOME) {
+        if (model.pos == 0) {
+            model.bells++;
+        } else {
+            model.pos = (key == PS2_KEY_HOME) ? 0 : model.pos - 1;
+        }
+    } else if (key == PS2_KEY_ARROW_RIGHT || key == PS2_KEY_END) {
+        if (model.pos == model.len) {
+            model.bells++;
+        } else {
+            model.pos = (key == PS2_KEY_END) ? model.len : model.pos + 1;
+        }
+    } else if (key == PS2_KEY_ARROW_UP || key == PS2_KEY_ARROW_DOWN) {
+        int next = model.recall + (key == PS2_KEY_ARROW_UP ? -1 : 1);
+        if (next < model.oldest || next > model.count) {
+            model.bells++;
+            return;
+        }
+        if (model.recall == model.count) copy_line(model.draft, model.line, MAX_LINE);
+        model.recall = next;
+        const char *line = (next == model.count) ? model.draft : model.history[next % MODEL_HISTORY];
+        model.len = model.pos = copy_line(model.line, line, model.bufsize);
+    } else if (key == '\b' || key == PS2_KEY_DELETE) {
+        if (key == '\b' ? model.pos == 0 : model.pos == model.len) {
+            model.bells++;
+            return;
+        }
+        if (key == '\b') model.pos--;
+        memcpy(model.line + model.pos, model.line + model.pos + 1, model.len - model.pos);
+        model.len--;
+    } else if (key == '\n') {
+        if (model.len > 0 && (model.count == 0 ||
+            strcmp(model.history[(model.count - 1) % MODEL_HISTORY], model.line) != 0)) {
+            copy_line(model.history[model.count % MODEL_HISTORY], model.line, MAX_LINE);
+            model.count++;
+        }
+    } else if (key < 0x90 && key != PS2_KEY_ESC) {
+        if (model.len == model.bufsize - 1) {
+            model.bells++;
+            return;
+        }
+        for (int i = model.len; i >= model.pos; i--) {
+            model.line[i + 1] = model.line[i];
+        }
+        model.line[model.pos++] = key;
+        model.len++;
+    }
+    if (model.len > model.maxlen) model.maxlen = model.len;
+}
+
+// helper function to check the buffer, the line's cells and the cursor
+// against the model
+static void check_screen(void)
+{
+    if (strcmp(line_buf, model.line) != 0) report("buffer differs");
+
+    // the screen scrolls up when the line first reaches past the bottom
+    int nrows = (PROMPT_LEN + model.maxlen + ncols - 1) / ncols;
+    int first = top;
+    if (first + nrows > NROWS) first = NROWS - nrows;
+
+    for (int i = 0; i < nrows * ncols; i++) {
+        char expected = ' ';
+        if (i < PROMPT_LEN) {
+            expected = PROMPT[i];
+        } else if (i < PROMPT_LEN + model.len) {
+            expected = model.line[i - PROMPT_LEN];
+        }
+        if (console_get_char(first + i / ncols, i % ncols) != expected) {
+            report("cells differ");
+            break;
+        }
+    }
+
+    // a cursor waiting to wrap at the end of a row puts the next char at
+    // the start of the row below, same as one already there
+    int at = PROMPT_LEN + model.pos;
+    int row = console_get_row();
+    int col = console_get_column();
+    if (col == ncols) {
+        row++;
+        col = 0;
+    }
+    if (row != first + at / ncols || col != at % ncols) report("cursor misplaced");
+}
+
+unsigned char keyboard_read_next(void)
+{
+    check_screen();
+    if (next_key == nkeys) {
+        report("ran out of keys");
+        return '\n';
+    }
+    unsigned char key = keys[next_key++];
+    model_key(key);
+    return key;
+}
+
+// helper function to read one line typed as `script` into a buffer of
+// `bufsize` chars, returns the line read
+static const char *read_line(const unsigned char *script, int n, int bufsize)
+{
+    static char buf[MAX_LINE];
+    keys = script;
+    nkeys = n;
+    next_key = 0;
+    line_buf = buf;
+    memset(buf, 'x', sizeof(buf));
+
+    console_printf(PROMPT);
+    top = console_get_row();
+    model.line[0] = '\0';
+    model.len = model.pos = model.maxlen = 0;
+    model.bufsize = bufsize;
+    model.recall = model.count;
+    model.oldest = model.count > MODEL_HISTORY ? model.count - MODEL_HISTORY : 0;
+    model.bells = num_bells = 0;
+
+    shell_readline(buf, bufsize);
+
+    if (next_key != nkeys) report("keys left over");
+    if (strcmp(buf, model.line) != 0) report("line read differs");
+    if (console_get_column() != 0) report("not on a new line");
+    if (num_bells != model.bells) report("wrong number of bells");
+    return buf;
+}
+
+// helper function to start a fresh console `width` columns wide, the
+// history carries over like it does in the shell
+static void reset(unsigned int width)
+{
+    ncols = width;
+    console_init(NROWS, ncols);
+    shell_init(console_printf);
+}
+
+#define LEFT PS2_KEY_ARROW_LEFT
+#define RIGHT PS2_KEY_ARROW_RIGHT
+#define UP PS2_KEY_ARROW_UP
+#define DOWN PS2_KEY_ARROW_DOWN
+#define HOME PS2_KEY_HOME
+#define END PS2_KEY_END
+#define DEL PS2_KEY_DELETE
+
+// edits by hand with known results, checking the model as well
+static int test_keys(void)
+{
+    static const struct {
+        unsigned char keys[40];
+        int bufsize;
+        const char *line;
+    } scripts[] = {
+        {{'h', 'e', 'l', 'l', 'o', '\n'}, MAX_LINE, "hello"},
+        {{'b', 'c', HOME, 'a', END, 'd', LEFT, LEFT, '\b', DEL, RIGHT, '\n'}, MAX_LINE, "ad"},
+        {{'\b', DEL, LEFT, RIGHT, 'o', 'k', '\n'}, MAX_LINE, "ok"},
+        {{'a', 'b', 'c', 'd', 'e', 'f', HOME, 'x', '\n'}, 5, "abcd"},
+        {{'n', 'e', 'w', UP, UP, DOWN, DOWN, '!', '\n'}, MAX_LINE, "new!"},
+        {{UP, UP, UP, UP, UP, '\b', '\n'}, MAX_LINE, "hell"},
+        {{UP, UP, UP, '\n'}, 3, "ab"},
+        {{UP, PS2_KEY_F1, PS2_KEY_PAGE_UP, '?', '\n'}, MAX_LINE, "ab?"},
+    };
+
+    errors = 0;
+    reset(12);
+    for (int i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+        int n = strlen((const char *) scripts[i].keys);
+        const char *line = read_line(scripts[i].keys, n, scripts[i].bufsize);
+        if (strcmp(line, scripts[i].line) != 0) {
+            printf("  script %d read \"%s\", expected \"%s\"\n", i, line, scripts[i].line);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+// random keys at widths from the prompt alone filling a row to a line
+// that never wraps, with buffers from a few chars up to MAX_LINE
+static int test_fuzz(void)
+{
+    static const unsigned int widths[] = {4, 5, 7, 12, 40, 80};
+    static const unsigned char special[] = {
+        LEFT, RIGHT, HOME, END, UP, DOWN, '\b', DEL,
+        PS2_KEY_PAGE_UP, PS2_KEY_PAGE_DOWN, PS2_KEY_F1,
+    };
+    unsigned char script[80];
+    errors = 0;
+
+    for (int w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        reset(widths[w]);
+        for (int i = 0; i < NUM_FUZZ_LINES; i++) {
+            int n = rand_below(sizeof(script) - 1);
+            for (int k = 0; k < n; k++) {
+                script[k] = rand_below(2) ? 'a' + rand_below(26)
+                                          : special[rand_below(sizeof(special))];
+            }
+            script[n++] = '\n';
+            read_line(script, n, 2 + rand_below(MAX_LINE - 1));
+        }
+    }
+    return errors;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} cases[] = {
+    {"readline_keys", test_keys},
+    {"readline_fuzz", test_fuzz},
+};
+
+int main(int argc, char *argv[])
+{
+    int failures = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int errors = cases[i].run();
+        if (errors == 0) {
+            printf("PASS %s\n", cases[i].name);
+        } else {
+            printf("FAIL %s: %d errors\n", cases[i].name, errors);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// Stand-ins for what the shell links against beyond the console. Bells
+// are counted instead of going to the terminal.
+
+int putchar(int ch);
+
+void uart_init(void)
+{
+}
+
+int uart_getchar(void)
+{
+    return -1;
+}
+
+int uart_putchar(int ch)
+{
+    if (ch == '\a') {
+        num_bells++;
+        return ch;
+    }
+    return putchar(ch);
+}
+
+void uart_flush(void)
+{
+}
+
+void keyboard_record_echo(void)
+{
+}
+
+const keyboard_latency_t *keyboard_get_echo_latency(void)
+{
+    return 0;
+}
+
+const keyboard_latency_t *keyboard_get_queue_latency(void)
+{
+    return 0;
+}
+
+void keyboard_reset_latency(void)
+{
+}
+
+malloc_counters_t malloc_get_counters(void)
+{
+    malloc_counters_t counters = {0};
+    return counters;
+}
+
+bool rb_get_stats(int i, rb_stats_t *stats)
+{
+    return false;
+}
+
+int bench_count(void)
+{
+    return 0;
+}
+
+const bench_t *bench_get(int i)
+{
+    return 0;
+}
+
+const bench_t *bench_find(const char *name)
+{
+    return 0;
+}
+
+bool bench_run(const bench_t *bench, int n, bench_result_t *result)
+{
+    return false;
+}
+
+void pi_reboot(void)
+{
+}
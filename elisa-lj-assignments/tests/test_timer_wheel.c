@@ -0,0 +1,276 @@
+#include "timer.h"
+#include "timerextra.h"
+#include "interrupts.h"
+#include "printf.h"
+#include "strings.h"
+
+/*
+ * Native test of the software timer wheel in timer.c, built with
+ * TIMER_FAKE_HARDWARE and run by `make host-test`. The system timer is
+ * a simulated clock: compare 3 raises an interrupt when the low word
+ * of the count passes it, which calls the handler, which runs the
+ * wheel's ticks. Every callback checks it runs no earlier than it was
+ * due and less than a tick late. The cases cover one-shot and periodic
+ * timers, cancelling from inside a callback, timers cascading down
+ * from every level, and a timer parked past the top level while the
+ * wheel has fallen hours behind.
+ */
+
+#define TICK TIMER_WHEEL_TICK_US
+#define SLOT_TICKS 64
+#define NUM_TIMERS 200
+#define MAX_REPORTS 5
+
+// the count starts just short of the low word wrapping
+#define START_US (0xFFFFFFFFULL - 5000000)
+
+volatile unsigned int fake_systimer_cs, fake_systimer_c3;
+volatile unsigned int fake_irq_enable_1, fake_irq_disable_1;
+static unsigned long long now_us = START_US;
+static handler_fn_t handler;
+static bool irq_enabled;
+
+typedef struct {
+    timer_event_t t;
+    unsigned long long due;     // when the next call is due
+    unsigned int period;
+    int calls;
+    int last_call;              // cancels itself on this call, 0 for never
+    timer_event_t *victim;      // cancels this one on its first call
+} record_t;
+
+static record_t records[NUM_TIMERS];
+static int errors;
+
+static unsigned int rand_state = 0x2545F491;
+
+// helper function for a xorshift random number in [0, n)
+static unsigned int rand_below(unsigned int n)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state % n;
+}
+
+// helper function to report a failure, only the first few are printed
+static void report(const record_t *r, const char *what)
+{
+    if (errors++ < MAX_REPORTS) {
+        printf("  timer %d at %d ms: %s\n", (int) (r - records),
+               (int) ((now_us - START_US) / 1000), what);
+    }
+}
+
+unsigned int timer_get_ticks(void)
+{
+    return (unsigned int) now_us;
+}
+
+unsigned long long timer_get_ticks64(void)
+{
+    return now_us;
+}
+
+bool interrupts_attach_handler(handler_fn_t fn)
+{
+    handler = fn;
+    return true;
+}
+
+void interrupts_global_enable(void)
+{
+}
+
+// helper function to pick up what timer.c last wrote to the interrupt
+// enable registers, where a disable comes after any enable
+static void latch_irq(void)
+{
+    if (fake_irq_enable_1 & (1 << 3)) irq_enabled = true;
+    if (fake_irq_disable_1 & (1 << 3)) irq_enabled = false;
+    fake_irq_enable_1 = fake_irq_disable_1 = 0;
+}
+
+// helper function to move the clock forward to `until`, interrupting
+// each time the low word of the count reaches compare 3 on the way
+static void run_until(unsigned long long until)
+{
+    while (1) {
+        unsigned int delta = fake_systimer_c3 - (unsigned int) now_us;
+        unsigned long long match = now_us + (delta ? delta : 1ULL << 32);
+        if (!irq_enabled || match > until) break;
+        now_us = match;
+        fake_systimer_cs = 1 << 3;
+        handler(0);
+        fake_systimer_cs = 0;
+        latch_irq();
+    }
+    now_us = until;
+}
+
+static void callback(void *arg)
+{
+    record_t *r = arg;
+    if (now_us < r->due) report(r, "ran early");
+    if (now_us - r->due >= TICK) report(r, "ran over a tick late");
+    r->calls++;
+    r->due += r->period;
+
+    if (r->calls == r->last_call) {
+        // a periodic timer is pending again by the time it is called
+        if (timer_cancel(&r->t) != (r->period != 0)) report(r, "cancel returned wrong");
+    }
+    if (r->victim && r->calls == 1) {
+        if (!timer_cancel(r->victim)) report(r, "victim wasn't pending");
+    }
+}
+
+// helper function to add timer `i`, cleared of any previous use
+static record_t *add(int i, unsigned int delay_us, unsigned int period_us)
+{
+    record_t *r = &records[i];
+    memset(r, 0, sizeof(*r));
+    r->due = now_us + delay_us;
+    r->period = period_us;
+    timer_add(&r->t, delay_us, period_us, callback, r);
+    latch_irq();
+    return r;
+}
+
+// helper function to check timer `i` ran `calls` times and is done
+static void expect_calls(int i, int calls)
+{
+    record_t *r = &records[i];
+    if (r->calls != calls) report(r, "wrong number of calls");
+    if (timer_pending(&r->t)) report(r, "still pending");
+}
+
+// one-shot timers either side of tick and slot boundaries
+static int test_oneshot(void)
+{
+    static const unsigned int delays[] = {
+        0, 1, TICK - 1, TICK, TICK + 1, 5000,
+        SLOT_TICKS * TICK - 1, SLOT_TICKS * TICK, SLOT_TICKS * TICK + 1,
+    };
+    int n = sizeof(delays) / sizeof(delays[0]);
+    errors = 0;
+    for (int i = 0; i < n; i++) {
+        add(i, delays[i], 0);
+        run_until(now_us + rand_below(TICK));
+    }
+    run_until(now_us + 2 * SLOT_TICKS * TICK);
+    for (int i = 0; i < n; i++) {
+        expect_calls(i, 1);
+    }
+    if (irq_enabled) report(&records[0], "interrupt left on with nothing pending");
+    return errors;
+}
+
+// periodic timers keep to their schedule for a while, then are cancelled
+static int test_periodic(void)
+{
+    static const unsigned int periods[] = {TICK, 3333, 65 * TICK, 100000, 1000000};
+    int n = sizeof(periods) / sizeof(periods[0]);
+    errors = 0;
+    for (int i = 0; i < n; i++) {
+        add(i, rand_below(periods[i]), periods[i]);
+    }
+    run_until(now_us + 10000000);
+    for (int i = 0; i < n; i++) {
+        record_t *r = &records[i];
+        // calls check they aren't early, so only missing ones are left
+        if (r->due + TICK <= now_us) report(r, "missed a call");
+        if (!timer_cancel(&r->t)) report(r, "wasn't pending");
+        expect_calls(i, r->calls);
+    }
+    return errors;
+}
+
+// callbacks cancelling themselves and timers due in the same or a later tick
+static int test_cancel(void)
+{
+    errors = 0;
+    add(0, 5000, 2000)->last_call = 3;
+    add(1, 9000, 0)->last_call = 1;
+    // 3 is added after 2, so runs first in the same slot
+    add(2, 20000, 0);
+    add(3, 20000, 0)->victim = &records[2].t;
+    add(4, 50000, 0);
+    add(5, 30000, 0)->victim = &records[4].t;
+    run_until(now_us + 1000000);
+    expect_calls(0, 3);
+    expect_calls(1, 1);
+    expect_calls(2, 0);
+    expect_calls(3, 1);
+    expect_calls(4, 0);
+    expect_calls(5, 1);
+    if (timer_cancel(&records[0].t)) report(&records[0], "cancelled twice");
+    return errors;
+}
+
+// delays into every level of the wheel and out to the longest there
+// is, so timers cascade down through each level on their way to running
+static int test_cascade(void)
+{
+    errors = 0;
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        // spread over every level: a random number of bits, then random bits
+        unsigned int bits = rand_below(33);
+        unsigned int delay = bits == 32 ? 0xFFFFFFFF - rand_below(TICK) :
+                             (1U << bits) + rand_below(1U << bits);
+        add(i, delay, 0);
+        run_until(now_us + rand_below(10 * TICK));
+    }
+    run_until(now_us + 0xFFFFFFFFULL + TICK);
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        expect_calls(i, 1);
+    }
+    return errors;
+}
+
+// With interrupts held off for hours the wheel falls behind, and a
+// timer added then is further from the wheel's next tick than the top
+// level reaches. It is parked until it comes into range and must still
+// run on time once the wheel has caught up.
+static int test_parked(void)
+{
+    errors = 0;
+    record_t *overdue = add(0, 1000000, 0);
+    irq_enabled = false;
+    now_us += 5ULL * 3600 * 1000000;
+    // the overdue timer runs as the wheel catches up, while 1 is added
+    overdue->due = now_us;
+    add(1, 0xFFFFFFFF, 0);
+    expect_calls(0, 1);
+    if (!timer_pending(&records[1].t)) report(&records[1], "not pending");
+    run_until(now_us + 0xFFFFFFFFULL + TICK);
+    expect_calls(1, 1);
+    return errors;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} cases[] = {
+    {"timer_oneshot", test_oneshot},
+    {"timer_periodic", test_periodic},
+    {"timer_cancel", test_cancel},
+    {"timer_cascade", test_cascade},
+    {"timer_parked", test_parked},
+};
+
+int main(int argc, char *argv[])
+{
+    timer_wheel_init();
+    int failures = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int errors = cases[i].run();
+        if (errors == 0) {
+            printf("PASS %s\n", cases[i].name);
+        } else {
+            printf("FAIL %s: %d errors\n", cases[i].name, errors);
+            failures++;
+        }
+    }
+    return failures;
+}
@@ -1,13 +1,67 @@
 #include "timer.h"
+#include "timerextra.h"
+#include "interrupts.h"
+
+// The host test in tests/test_timer_wheel.c builds this file with
+// TIMER_FAKE_HARDWARE set. It supplies timer_get_ticks(),
+// timer_get_ticks64() and these registers, and IRQs are never masked.
+#ifndef TIMER_FAKE_HARDWARE
+#define TIMER_FAKE_HARDWARE 0
+#endif
+
+#if TIMER_FAKE_HARDWARE
+extern volatile unsigned int fake_systimer_cs, fake_systimer_c3;
+extern volatile unsigned int fake_irq_enable_1, fake_irq_disable_1;
+#define SYSTIMER_CS (&fake_systimer_cs)
+#define SYSTIMER_C3 (&fake_systimer_c3)
+#define IRQ_ENABLE_1 (&fake_irq_enable_1)
+#define IRQ_DISABLE_1 (&fake_irq_disable_1)
+#else
+#define SYSTIMER_CS ((volatile unsigned int *) 0x20003000)
+#define SYSTIMER_CLO ((volatile unsigned int *) 0x20003004)
+#define SYSTIMER_CHI ((volatile unsigned int *) 0x20003008)
+#define SYSTIMER_C3 ((volatile unsigned int *) 0x20003018)
+#define IRQ_ENABLE_1 ((volatile unsigned int *) 0x2000B210)
+#define IRQ_DISABLE_1 ((volatile unsigned int *) 0x2000B21C)
+#endif
+#define SYSTIMER_M3 (1 << 3)
+#define CPSR_IRQ_MASK 0x80
+
+// wheel geometry, see timerextra.h
+#define TICK_SHIFT 10
+#define SLOT_BITS 6
+#define NUM_SLOTS (1 << SLOT_BITS)
+#define SLOT_MASK (NUM_SLOTS - 1)
+#define NUM_LEVELS 4
+
+static timer_event_t *wheel[NUM_LEVELS][NUM_SLOTS];
+// the next tick to run, ticks before it have all been run
+static unsigned long long base_tick;
+static unsigned int num_pending = 0;
+static unsigned int num_level0 = 0;
+// set while run_due() runs callbacks, which may add timers
+static bool running = false;
 
 void timer_init(void) {
 }
 
+#if !TIMER_FAKE_HARDWARE
 unsigned int timer_get_ticks(void) {
     volatile unsigned int* timerAddress = (volatile unsigned int*) 0x20003004;
     return *timerAddress;
 }
 
+unsigned long long timer_get_ticks64(void) {
+    // the low word can carry into the high one between the two reads
+    unsigned int hi, lo;
+    do {
+        hi = *SYSTIMER_CHI;
+        lo = *SYSTIMER_CLO;
+    } while (*SYSTIMER_CHI != hi);
+    return ((unsigned long long) hi << 32) | lo;
+}
+#endif
+
 void timer_delay_us(unsigned int usecs) {
     unsigned int start = timer_get_ticks();
     while (timer_get_ticks() - start < usecs) { /* spin */ }
@@ -20,3 +74,171 @@ void timer_delay_ms(unsigned int msecs) {
 void timer_delay(unsigned int secs) {
     timer_delay_us(1000000*secs);
 }
+
+// helper function to mask IRQs, returning the old cpsr for unmask_irq()
+static unsigned int mask_irq(void)
+{
+    unsigned int cpsr = 0;
+#if !TIMER_FAKE_HARDWARE
+    __asm__ volatile ("mrs %0, cpsr" : "=r" (cpsr));
+    __asm__ volatile ("msr cpsr_c, %0" : : "r" (cpsr | CPSR_IRQ_MASK) : "memory");
+#endif
+    return cpsr;
+}
+
+static void unmask_irq(unsigned int cpsr)
+{
+#if !TIMER_FAKE_HARDWARE
+    __asm__ volatile ("msr cpsr_c, %0" : : "r" (cpsr) : "memory");
+#endif
+}
+
+// helper function to put `t` in the slot for its expiry relative to base_tick
+static void insert_timer(timer_event_t *t)
+{
+    // round up so a timer never runs early
+    unsigned long long expires = (t->expires_us + (1 << TICK_SHIFT) - 1) >> TICK_SHIFT;
+    if (expires < base_tick) expires = base_tick;
+    unsigned long long delta = expires - base_tick;
+
+    int level = 0;
+    while (level < NUM_LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    // too far out for the top level, park it in the last slot it reaches
+    if (delta >= (1ULL << (SLOT_BITS * NUM_LEVELS))) {
+        expires = base_tick + (1ULL << (SLOT_BITS * NUM_LEVELS)) - 1;
+    }
+
+    timer_event_t **slot = &wheel[level][(expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    t->next = *slot;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = slot;
+    t->level = level;
+    *slot = t;
+
+    num_pending++;
+    if (level == 0) num_level0++;
+}
+
+// helper function to take `t` out of its slot
+static void remove_timer(timer_event_t *t)
+{
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->pprev = 0;
+
+    num_pending--;
+    if (t->level == 0) num_level0--;
+}
+
+// helper function to run tick base_tick: first refill level 0 from the
+// levels above whenever it wraps, then run the timers in its slot
+static void run_tick(void)
+{
+    unsigned long long tick = base_tick++;
+
+    // each level's slot moves down when the level below has wrapped
+    for (int level = 1; level < NUM_LEVELS; level++) {
+        if ((tick >> (SLOT_BITS * (level - 1))) & SLOT_MASK) break;
+        timer_event_t **slot = &wheel[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK];
+        // inserted relative to this tick, so none land back in this slot
+        base_tick = tick;
+        while (*slot) {
+            timer_event_t *t = *slot;
+            remove_timer(t);
+            insert_timer(t);
+        }
+        base_tick = tick + 1;
+    }
+
+    // Taken from the head one at a time since a callback may cancel
+    // or add others. Anything added now is due next tick at the soonest.
+    timer_event_t **slot = &wheel[0][tick & SLOT_MASK];
+    while (*slot) {
+        timer_event_t *t = *slot;
+        remove_timer(t);
+        // periodic timers go back in first so the callback can cancel them
+        if (t->period_us) {
+            t->expires_us += t->period_us;
+            insert_timer(t);
+        }
+        t->fn(t->arg);
+    }
+}
+
+// helper function to run every tick that is due, then set compare 3 for
+// the next one that might have something to run. Called with IRQs masked.
+static void run_due(void)
+{
+    running = true;
+    while (num_pending > 0) {
+        unsigned long long now = timer_get_ticks64() >> TICK_SHIFT;
+        while (base_tick <= now && num_pending > 0) {
+            run_tick();
+        }
+        if (num_pending == 0) break;
+
+        // with level 0 empty nothing can run before it next wraps
+        unsigned long long next = base_tick;
+        if (num_level0 == 0) next = (base_tick + SLOT_MASK) & ~(unsigned long long) SLOT_MASK;
+        unsigned int at = (unsigned int) (next << TICK_SHIFT);
+        *SYSTIMER_C3 = at;
+        *SYSTIMER_CS = SYSTIMER_M3;
+        *IRQ_ENABLE_1 = SYSTIMER_M3;
+        // if it came due while being set the match was missed, go again
+        if ((int) (timer_get_ticks() - at) < 0) {
+            running = false;
+            return;
+        }
+    }
+    *IRQ_DISABLE_1 = SYSTIMER_M3;
+    *SYSTIMER_CS = SYSTIMER_M3;
+    running = false;
+}
+
+static void timer_handler(unsigned int pc)
+{
+    if (!(*SYSTIMER_CS & SYSTIMER_M3)) return;
+    *SYSTIMER_CS = SYSTIMER_M3;
+    run_due();
+}
+
+void timer_wheel_init(void)
+{
+    interrupts_attach_handler(timer_handler);
+    interrupts_global_enable();
+}
+
+void timer_add(timer_event_t *t, unsigned int delay_us, unsigned int period_us,
+               timer_callback_t fn, void *arg)
+{
+    unsigned int cpsr = mask_irq();
+    if (t->pprev) remove_timer(t);
+
+    // an empty wheel has had no reason to keep up with the time
+    if (num_pending == 0) base_tick = timer_get_ticks64() >> TICK_SHIFT;
+    t->expires_us = timer_get_ticks64() + delay_us;
+    t->period_us = period_us;
+    t->fn = fn;
+    t->arg = arg;
+    insert_timer(t);
+
+    // from a callback, run_due() sets compare 3 once the callbacks are done
+    if (!running) run_due();
+    unmask_irq(cpsr);
+}
+
+bool timer_cancel(timer_event_t *t)
+{
+    unsigned int cpsr = mask_irq();
+    bool pending = (t->pprev != 0);
+    if (pending) remove_timer(t);
+    unmask_irq(cpsr);
+    return pending;
+}
+
+bool timer_pending(const timer_event_t *t)
+{
+    return t->pprev != 0;
+}
@@ -0,0 +1,79 @@
+#ifndef TIMEREXTRA_H
+#define TIMEREXTRA_H
+
+/*
+ * Extensions to the library timer module (timer.h) implemented in
+ * timer.c.
+ *
+ * Software timers run callbacks from the system timer compare 3
+ * interrupt. Pending timers sit in a hierarchical wheel of 4 levels of
+ * 64 slots, so adding or cancelling one is constant time however many
+ * are pending. Level 0 slots are TIMER_WHEEL_TICK_US apart and each
+ * level's slots are 64 times the span of the one below; a timer moves
+ * down a level each time the level below wraps around. The top level
+ * reaches about 4.7 hours past the wheel's next tick, so a timer only
+ * falls beyond it when the wheel has fallen hours behind. It is then
+ * parked in the last slot the top level reaches until it comes into
+ * range.
+ *
+ * While nothing is due within the next 64 ticks the interrupt only
+ * fires when level 0 wraps, and with no timers pending it is off.
+ */
+
+#include "timer.h"
+#include <stdbool.h>
+
+#define TIMER_WHEEL_TICK_US 1024
+
+typedef void (*timer_callback_t)(void *arg);
+
+/*
+ * A software timer. The storage belongs to the caller and must stay
+ * valid while the timer is pending; the fields are private to timer.c.
+ * It must start out zeroed, e.g. `static timer_event_t t;` or
+ * `timer_event_t t = {0};`.
+ */
+typedef struct timer_event {
+    struct timer_event *next;
+    struct timer_event **pprev;     // null when not pending
+    unsigned int level;             // wheel level of the slot it is in
+    unsigned long long expires_us;
+    unsigned int period_us;         // 0 for one-shot
+    timer_callback_t fn;
+    void *arg;
+} timer_event_t;
+
+/*
+ * Returns the full 64-bit system timer count in microseconds, which
+ * won't wrap for over half a million years.
+ */
+unsigned long long timer_get_ticks64(void);
+
+/*
+ * Attaches the compare 3 interrupt handler and enables interrupts.
+ * Must be called once before timer_add().
+ */
+void timer_wheel_init(void);
+
+/*
+ * Schedules `fn(arg)` to run in interrupt context `delay_us` from now,
+ * then every `period_us` after that if it is non-zero. Callbacks run
+ * late by up to one tick. A periodic timer keeps to its original
+ * schedule rather than drifting by the callback's lateness. Adding a
+ * timer that is already pending reschedules it.
+ */
+void timer_add(timer_event_t *t, unsigned int delay_us, unsigned int period_us,
+               timer_callback_t fn, void *arg);
+
+/*
+ * Stops `t` from running again, which a callback may do to itself.
+ * Returns false if it wasn't pending.
+ */
+bool timer_cancel(timer_event_t *t);
+
+/*
+ * Returns whether `t` is waiting to run.
+ */
+bool timer_pending(const timer_event_t *t);
+
+#endif